@@ -6,17 +6,73 @@
 #define SNOW_HTTP_SERVER_CORO_HTTP_HANDLER_H
 
 #include <iostream>
+#include <exception>
 #include <functional>
 #include <experimental/coroutine>
 #include "http/http_message.h"
+#include "frame_pool.h"
 
 namespace snow {
     // CoroTask is the return type for our coroutine. It acts as a handle
     // to manage the coroutine from the caller's perspective. It doesn't
     // contain the coroutine's logic itself, but provides an interface to
     // control its lifecycle (e.g., resume, check status) and get its result.
+    //
+    // A CoroTask can itself be co_awaited, so a handler can be split into
+    // sub-coroutines:
+    //
+    //     CoroTask LoadUser(const HttpRequest &request);
+    //     CoroTask Handler(const HttpRequest &request) {
+    //         HttpResponse user = co_await LoadUser(request);
+    //         ...
+    //     }
+    //
+    // Awaiting starts the sub-coroutine and, when it finishes, resumes the awaiting
+    // one directly (symmetric transfer): neither step goes through a scheduler, and
+    // the stack does not grow however deep the chain of awaits gets. An exception
+    // that escapes a sub-coroutine is rethrown from co_await; one that escapes the
+    // handler itself is kept in the promise, and the server answers 500.
     class CoroTask {
     public:
+        struct promise_type;
+
+        // Awaiter returned by final_suspend(). Suspending here keeps the frame alive.
+        // An awaited task then transfers straight to the coroutine awaiting it; a
+        // top-level task hands control to on_complete instead. The callback is moved
+        // out of the promise first because it is allowed to destroy the frame it
+        // lives in.
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+
+            template<class Promise>
+            std::experimental::coroutine_handle<> await_suspend(
+                    std::experimental::coroutine_handle<Promise> handle) noexcept {
+                if (handle.promise().continuation) {
+                    return handle.promise().continuation;
+                }
+                if (handle.promise().on_complete) {
+                    auto on_complete = std::move(handle.promise().on_complete);
+                    on_complete();
+                }
+                return std::experimental::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        // Returned by co_await on a CoroTask: starts the task and suspends the
+        // awaiting coroutine until the task finishes.
+        struct Awaiter {
+            std::experimental::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return !handle || handle.done(); }
+
+            std::experimental::coroutine_handle<> await_suspend(
+                    std::experimental::coroutine_handle<> awaiting) noexcept;
+
+            HttpResponse await_resume();
+        };
+
         // The promise_type is a special struct the C++ compiler looks for.
         // It defines the behavior of the coroutine at different stages of its life.
         struct promise_type {
@@ -25,6 +81,26 @@ namespace snow {
             // moved into this member variable.
             HttpResponse response;
 
+            // Called once the coroutine has finished and is parked at its final
+            // suspend point. A coroutine that suspends on asynchronous I/O is resumed
+            // by whoever completes that I/O, so this callback, not the caller of
+            // resume(), is what learns that the response is ready. It may destroy
+            // the CoroTask (and with it this frame).
+            std::function<void()> on_complete;
+
+            // The coroutine co_awaiting this one, resumed when this one finishes.
+            std::experimental::coroutine_handle<> continuation;
+
+            // An exception that escaped the coroutine body.
+            std::exception_ptr exception;
+
+            // Frames come from per-thread pools rather than the global heap; see FramePool.
+            static void *operator new(std::size_t size) { return FramePool::Allocate(size); }
+
+            static void operator delete(void *frame, std::size_t size) noexcept {
+                FramePool::Deallocate(frame, size);
+            }
+
             // This function is called by the compiler to create the object
             // that is returned from the coroutine function (i.e., the CoroTask handle).
             // It links our CoroTask object to the coroutine's internal state.
@@ -39,38 +115,66 @@ namespace snow {
             auto initial_suspend() { return std::experimental::suspend_always{}; }
 
             // This function is called just before the coroutine's function body
-            // is about to finish. Returning `suspend_always{}` tells the compiler
-            // to suspend the coroutine. This is critical as it prevents the
-            // coroutine from being automatically destroyed, giving the caller a
-            // chance to retrieve the result.
-            auto final_suspend() { return std::experimental::suspend_always{}; }
+            // is about to finish. The returned awaiter always suspends. This is critical
+            // as it prevents the coroutine from being automatically destroyed, giving the
+            // caller a chance to retrieve the result. It then runs on_complete.
+            auto final_suspend() noexcept { return FinalAwaiter{}; }
 
             // This function is called when the coroutine executes a `co_return` statement.
             // The value returned by the coroutine is passed to this function.
             void return_value(HttpResponse value) { response = std::move(value); }
 
             // This is a mandatory function in the promise_type. It is called if
-            // an unhandled exception is thrown inside the coroutine's body.
-            // For this simple example, we do nothing with it.
-            void unhandled_exception() {}
+            // an unhandled exception is thrown inside the coroutine's body. The
+            // exception is kept for whoever awaits the task, or for the server.
+            void unhandled_exception() { exception = std::current_exception(); }
         };
 
         // This is the constructor for our CoroTask handle. It takes a coroutine_handle
         // which points to the coroutine's internal state.
         explicit CoroTask(std::experimental::coroutine_handle<promise_type> handle) : handle_(handle) {}
 
+        // An empty task that owns no coroutine.
+        CoroTask() = default;
+
+        // A CoroTask owns its frame, so it can be moved but not copied.
+        CoroTask(CoroTask &&other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+
+        CoroTask &operator=(CoroTask &&other) noexcept {
+            if (this != &other) {
+                if (handle_) handle_.destroy();
+                handle_ = other.handle_;
+                other.handle_ = nullptr;
+            }
+            return *this;
+        }
+
+        CoroTask(const CoroTask &) = delete;
+
+        CoroTask &operator=(const CoroTask &) = delete;
+
         // The destructor cleans up the coroutine's state by destroying the handle.
         // This is necessary because final_suspend() prevented the automatic cleanup.
         ~CoroTask() { if (handle_) handle_.destroy(); }
 
+        // Registers the callback run when the coroutine finishes, see promise_type::on_complete.
+        void set_on_complete(std::function<void()> callback) { handle_.promise().on_complete = std::move(callback); }
+
         // This function resumes the coroutine from its suspended state.
         void resume() { handle_.resume(); }
 
         // Checks if the coroutine has finished its execution.
         bool done() { return handle_.done(); }
 
-        // Retrieves the final HttpResponse value from the coroutine's promise.
-        HttpResponse get_response() { return handle_.promise().response; }
+        // The final HttpResponse, still inside the coroutine's promise. It lives as long
+        // as this task; move from it to keep it longer.
+        HttpResponse &get_response() { return handle_.promise().response; }
+
+        // The exception that ended the coroutine, or null if it returned normally.
+        std::exception_ptr exception() const { return handle_.promise().exception; }
+
+        // Lets another coroutine co_await this task, see the class comment.
+        Awaiter operator co_await() noexcept { return Awaiter{handle_}; }
 
     private:
         // The coroutine handle. It points to the coroutine's state,
@@ -78,6 +182,22 @@ namespace snow {
         std::experimental::coroutine_handle<promise_type> handle_;
     };
 
+    inline std::experimental::coroutine_handle<> CoroTask::Awaiter::await_suspend(
+            std::experimental::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    inline HttpResponse CoroTask::Awaiter::await_resume() {
+        if (!handle) {
+            return HttpResponse();
+        }
+        if (handle.promise().exception) {
+            std::rethrow_exception(handle.promise().exception);
+        }
+        return std::move(handle.promise().response);
+    }
+
     // This is the coroutine function. It's marked as a coroutine because
     // its return type is `CoroTask`. When the compiler sees this, it
     // will transform the function's body to support coroutine behavior
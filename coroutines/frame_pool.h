@@ -0,0 +1,106 @@
+#ifndef SNOW_HTTP_SERVER_FRAME_POOL_H
+#define SNOW_HTTP_SERVER_FRAME_POOL_H
+
+#include <cstddef>
+#include <new>
+
+namespace snow {
+    // Per-thread free lists for coroutine frames, one per power-of-two size class.
+    //
+    // A coroutine's frame is allocated when the coroutine function is called and
+    // freed when its task is destroyed, once per request or sub-call. Frames of one
+    // handler always have the same size, so after warm-up every allocation is a pop
+    // from a thread-local list and every free is a push, without locks or malloc.
+    //
+    // A frame may be freed on another thread than the one that allocated it (a
+    // handler suspended on a worker and finished on the event loop); it then simply
+    // joins the freeing thread's list. Each list keeps at most kMaxCachedFrames, so a
+    // thread that only frees cannot hoard memory. Frames larger than the biggest
+    // class go to the global allocator.
+    class FramePool {
+    public:
+        static constexpr std::size_t kMinClassSize = 64;
+        static constexpr std::size_t kClassCount = 8;       // 64 B .. 8 KiB
+        static constexpr std::size_t kMaxCachedFrames = 256;
+
+        static void *Allocate(std::size_t size) {
+            std::size_t index = ClassIndex(size);
+            if (index == kClassCount) {
+                return ::operator new(size);
+            }
+            FreeList &list = Lists().lists[index];
+            if (list.head) {
+                FreeBlock *block = list.head;
+                list.head = block->next;
+                --list.count;
+                return block;
+            }
+            return ::operator new(ClassSize(index));
+        }
+
+        // size must be the size passed to Allocate, which the sized operator delete
+        // of a promise type is guaranteed to receive.
+        static void Deallocate(void *frame, std::size_t size) noexcept {
+            std::size_t index = ClassIndex(size);
+            if (index == kClassCount) {
+                ::operator delete(frame);
+                return;
+            }
+            FreeList &list = Lists().lists[index];
+            if (list.count >= kMaxCachedFrames) {
+                ::operator delete(frame);
+                return;
+            }
+            auto *block = static_cast<FreeBlock *>(frame);
+            block->next = list.head;
+            list.head = block;
+            ++list.count;
+        }
+
+    private:
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        struct FreeList {
+            FreeBlock *head = nullptr;
+            std::size_t count = 0;
+        };
+
+        // Returns the cached frames to the global allocator when the thread exits.
+        struct ThreadLists {
+            FreeList lists[kClassCount];
+
+            ~ThreadLists() {
+                for (FreeList &list : lists) {
+                    while (list.head) {
+                        FreeBlock *block = list.head;
+                        list.head = block->next;
+                        ::operator delete(block);
+                    }
+                }
+            }
+        };
+
+        static ThreadLists &Lists() {
+            thread_local ThreadLists lists;
+            return lists;
+        }
+
+        static constexpr std::size_t ClassSize(std::size_t index) {
+            return kMinClassSize << index;
+        }
+
+        // kClassCount means "too large for the pool"
+        static constexpr std::size_t ClassIndex(std::size_t size) {
+            std::size_t index = 0;
+            while (index < kClassCount && ClassSize(index) < size) {
+                ++index;
+            }
+            return index;
+        }
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_FRAME_POOL_H
@@ -0,0 +1,214 @@
+#include "ByteRange.h"
+
+#include <algorithm>
+#include <charconv>
+#include <random>
+
+namespace snow {
+    namespace {
+        //合并之后仍然超过这个数量的Range被忽略，防止用大量小区间放大回复(RFC 7233 6.1)
+        constexpr size_t kMaxRanges = 16;
+
+        std::string_view TrimOws(std::string_view s) {
+            while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+            while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+            return s;
+        }
+
+        bool ParseNumber(std::string_view text, std::uint64_t *out) {
+            if (text.empty()) return false;
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), *out);
+            return error == std::errc() && end == text.data() + text.size();
+        }
+
+        enum class SpecResult {
+            kInvalid,       //语法错误，整个Range被忽略
+            kUnsatisfiable, //语法正确但不在表示范围内
+            kOk
+        };
+
+        //解析一个byte-range-spec或suffix-byte-range-spec，并按size求出实际区间
+        SpecResult ParseSpec(std::string_view spec, std::uint64_t size, ByteRange *range) {
+            size_t dash = spec.find('-');
+            if (dash == std::string_view::npos) return SpecResult::kInvalid;
+            std::string_view first_text = spec.substr(0, dash);
+            std::string_view last_text = spec.substr(dash + 1);
+
+            if (first_text.empty()) {
+                //"-n"：最后n个字节
+                std::uint64_t suffix;
+                if (!ParseNumber(last_text, &suffix)) return SpecResult::kInvalid;
+                if (suffix == 0 || size == 0) return SpecResult::kUnsatisfiable;
+                suffix = std::min(suffix, size);
+                *range = ByteRange{size - suffix, suffix};
+                return SpecResult::kOk;
+            }
+
+            std::uint64_t first;
+            if (!ParseNumber(first_text, &first)) return SpecResult::kInvalid;
+            std::uint64_t last = UINT64_MAX;
+            if (!last_text.empty()) {
+                if (!ParseNumber(last_text, &last) || last < first) return SpecResult::kInvalid;
+            }
+            if (first >= size) return SpecResult::kUnsatisfiable;
+            last = std::min(last, size - 1);
+            *range = ByteRange{first, last - first + 1};
+            return SpecResult::kOk;
+        }
+
+        //If-Range：实体标签要求强比较，弱标签永远不匹配；日期只有和Last-Modified完全相同才匹配
+        bool IfRangeMatches(std::string_view if_range, std::string_view etag, std::string_view last_modified) {
+            if (if_range.empty()) return true;
+            if (if_range.front() == '"' || if_range.substr(0, 2) == "W/") {
+                return !etag.empty() && etag.substr(0, 2) != "W/" && if_range == etag;
+            }
+            return !last_modified.empty() && if_range == last_modified;
+        }
+
+        std::string MakeBoundary() {
+            thread_local std::mt19937_64 rng{std::random_device{}()};
+            static constexpr char kHex[] = "0123456789abcdef";
+            std::string boundary(24, '0');
+            std::uint64_t a = rng(), b = rng();
+            for (size_t i = 0; i < 16; ++i) boundary[i] = kHex[(a >> (i * 4)) & 0xf];
+            for (size_t i = 16; i < boundary.size(); ++i) boundary[i] = kHex[(b >> (i * 4 - 64)) & 0xf];
+            return boundary;
+        }
+    }
+
+    RangePlan PlanRanges(const HttpRequest &request, std::uint64_t size,
+                         std::string_view etag, std::string_view last_modified) {
+        RangePlan plan;
+        HttpMethod method = request.getMethod();
+        if (method != HttpMethod::GET && method != HttpMethod::HEAD) {
+            return plan;
+        }
+        std::string_view value = request.getHeadersValue("Range");
+        if (value.empty() || !IfRangeMatches(request.getHeadersValue("If-Range"), etag, last_modified)) {
+            return plan;
+        }
+
+        if (value.size() < 6 || value.substr(0, 6) != "bytes=") {
+            return plan;    //不认识的range单位
+        }
+        value.remove_prefix(6);
+
+        std::vector<ByteRange> ranges;
+        bool any_spec = false;
+        while (!value.empty()) {
+            size_t comma = value.find(',');
+            std::string_view spec = TrimOws(value.substr(0, comma));
+            value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+            if (spec.empty()) continue;     //允许空的列表元素
+            any_spec = true;
+            ByteRange range{};
+            switch (ParseSpec(spec, size, &range)) {
+                case SpecResult::kInvalid:
+                    return plan;
+                case SpecResult::kUnsatisfiable:
+                    break;
+                case SpecResult::kOk:
+                    ranges.push_back(range);
+                    break;
+            }
+        }
+        if (!any_spec) {
+            return plan;
+        }
+        if (ranges.empty()) {
+            plan.status = HttpStatusCode::RangeNotSatisfiable;
+            return plan;
+        }
+
+        //重叠或相邻的区间合并成一个
+        std::sort(ranges.begin(), ranges.end(),
+                  [](const ByteRange &a, const ByteRange &b) { return a.first < b.first; });
+        std::vector<ByteRange> merged;
+        for (const ByteRange &range : ranges) {
+            if (!merged.empty() && range.first <= merged.back().first + merged.back().length) {
+                std::uint64_t end = std::max(merged.back().first + merged.back().length, range.first + range.length);
+                merged.back().length = end - merged.back().first;
+            } else {
+                merged.push_back(range);
+            }
+        }
+        if (merged.size() > kMaxRanges) {
+            return plan;
+        }
+        plan.status = HttpStatusCode::PartialContent;
+        plan.ranges = std::move(merged);
+        return plan;
+    }
+
+    std::string ContentRange(const ByteRange &range, std::uint64_t size) {
+        return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.first + range.length - 1) +
+               "/" + std::to_string(size);
+    }
+
+    std::string UnsatisfiedContentRange(std::uint64_t size) {
+        return "bytes */" + std::to_string(size);
+    }
+
+    MultipartRanges::MultipartRanges(std::string_view content_type, std::uint64_t size)
+            : boundary_(MakeBoundary()), content_type_(content_type), size_(size) {}
+
+    std::string MultipartRanges::ContentType() const {
+        return "multipart/byteranges; boundary=" + boundary_;
+    }
+
+    std::string MultipartRanges::PartHeader(const ByteRange &range) const {
+        std::string header = "\r\n--" + boundary_ + "\r\n";
+        if (!content_type_.empty()) {
+            header += "Content-Type: " + content_type_ + "\r\n";
+        }
+        header += "Content-Range: " + ContentRange(range, size_) + "\r\n\r\n";
+        return header;
+    }
+
+    std::string MultipartRanges::Closing() const {
+        return "\r\n--" + boundary_ + "--\r\n";
+    }
+
+    std::uint64_t MultipartRanges::ContentLength(const std::vector<ByteRange> &ranges) const {
+        std::uint64_t length = Closing().size();
+        for (const ByteRange &range : ranges) {
+            length += PartHeader(range).size() + range.length;
+        }
+        return length;
+    }
+
+    void ApplyRanges(const HttpRequest &request, HttpResponse *response) {
+        if (response->getStatusCode() != HttpStatusCode::Ok) {
+            return;
+        }
+        response->setHeader("Accept-Ranges", "bytes");
+        // A view into the response's own body; the branches below replace the body
+        // only after they are done reading from it.
+        std::string_view content = response->getContent();
+        RangePlan plan = PlanRanges(request, content.size(), response->getHeadersValue("ETag"),
+                                    response->getHeadersValue("Last-Modified"));
+
+        if (plan.status == HttpStatusCode::RangeNotSatisfiable) {
+            response->setStatusCode(plan.status);
+            response->setHeader("Content-Range", UnsatisfiedContentRange(content.size()));
+            response->clearContent();
+        } else if (plan.status == HttpStatusCode::PartialContent && plan.ranges.size() == 1) {
+            const ByteRange &range = plan.ranges.front();
+            response->setStatusCode(plan.status);
+            response->setHeader("Content-Range", ContentRange(range, content.size()));
+            response->setContent(content.substr(range.first, range.length));
+        } else if (plan.status == HttpStatusCode::PartialContent) {
+            MultipartRanges multipart(response->getHeadersValue("Content-Type"), content.size());
+            std::string body;
+            body.reserve(multipart.ContentLength(plan.ranges));
+            for (const ByteRange &range : plan.ranges) {
+                body += multipart.PartHeader(range);
+                body.append(content.substr(range.first, range.length));
+            }
+            body += multipart.Closing();
+            response->setStatusCode(plan.status);
+            response->setHeader("Content-Type", multipart.ContentType());
+            response->setContent(body);
+        }
+    }
+}
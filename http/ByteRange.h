@@ -0,0 +1,64 @@
+//Range请求(RFC 7233)：解析Range/If-Range，决定回复200、206还是416，
+//以及生成multipart/byteranges的分隔内容
+
+#ifndef BYTE_RANGE_H
+#define BYTE_RANGE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http_message.h"
+
+namespace snow {
+    //完整表示中的一段，first是起始偏移
+    struct ByteRange {
+        std::uint64_t first;
+        std::uint64_t length;
+    };
+
+    struct RangePlan {
+        HttpStatusCode status = HttpStatusCode::Ok;  //Ok、PartialContent或RangeNotSatisfiable
+        std::vector<ByteRange> ranges;               //PartialContent时按偏移排序，互不重叠
+    };
+
+    //根据请求的Range和If-Range决定如何回复一个长度为size的表示
+    //etag和last_modified是这个表示的校验值，If-Range与它们都不匹配时忽略Range
+    //语法错误或者区间过多的Range也被忽略，回复完整的200
+    RangePlan PlanRanges(const HttpRequest &request, std::uint64_t size,
+                         std::string_view etag, std::string_view last_modified);
+
+    //"bytes first-last/size"
+    std::string ContentRange(const ByteRange &range, std::uint64_t size);
+
+    //416时使用的"bytes */size"
+    std::string UnsatisfiedContentRange(std::uint64_t size);
+
+    //多个区间的206回复使用multipart/byteranges，每个区间前面是一个part header，最后是结束分隔行
+    class MultipartRanges {
+    public:
+        MultipartRanges(std::string_view content_type, std::uint64_t size);
+
+        //整个回复的Content-Type
+        std::string ContentType() const;
+
+        std::string PartHeader(const ByteRange &range) const;
+
+        std::string Closing() const;
+
+        //包括所有part header、区间数据和结束分隔行的body长度
+        std::uint64_t ContentLength(const std::vector<ByteRange> &ranges) const;
+
+    private:
+        std::string boundary_;
+        std::string content_type_;
+        std::uint64_t size_;
+    };
+
+    //把内存中的完整200响应按请求的Range改写成206或416
+    //用于body已经在内存中的响应，例如预先生成的响应
+    void ApplyRanges(const HttpRequest &request, HttpResponse *response);
+}
+
+#endif
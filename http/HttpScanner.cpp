@@ -0,0 +1,239 @@
+#include "HttpScanner.h"
+
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SNOW_SCANNER_X86 1
+#endif
+
+namespace snow {
+    namespace {
+        constexpr size_t npos = LineScan::npos;
+
+        enum ByteClass : std::uint8_t {
+            kEol = 1,       //'\r' '\n'
+            kColon = 2,
+            kCtl = 4,       //控制字符(除HTAB)和DEL
+            kToken = 8      //tchar
+        };
+
+        constexpr bool IsTchar(unsigned c) {
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) return true;
+            for (char t : std::string_view("!#$%&'*+-.^_`|~")) {
+                if (c == static_cast<unsigned char>(t)) return true;
+            }
+            return false;
+        }
+
+        constexpr std::array<std::uint8_t, 256> MakeClassTable() {
+            std::array<std::uint8_t, 256> table{};
+            for (unsigned c = 0; c < 256; ++c) {
+                std::uint8_t cls = 0;
+                if (c == '\r' || c == '\n') cls |= kEol;
+                if (c == ':') cls |= kColon;
+                if ((c < 0x20 && c != '\t') || c == 0x7f) cls |= kCtl;
+                if (IsTchar(c)) cls |= kToken;
+                table[c] = cls;
+            }
+            return table;
+        }
+
+        constexpr std::array<std::uint8_t, 256> kClassTable = MakeClassTable();
+
+        //标量实现，也用于处理SIMD块之后不足一个块的尾部
+        LineScan ScanScalar(const char *data, size_t pos, size_t size, LineScan r) {
+            for (; pos < size; ++pos) {
+                std::uint8_t cls = kClassTable[static_cast<unsigned char>(data[pos])];
+                if (cls & kEol) {
+                    r.line_end = pos;
+                    return r;
+                }
+                if ((cls & kCtl) && r.ctl == npos) r.ctl = pos;
+                if (r.colon == npos) {
+                    if (cls & kColon) {
+                        r.colon = pos;
+                    } else if (!(cls & kToken) && r.non_token == npos) {
+                        r.non_token = pos;
+                    }
+                }
+            }
+            return r;
+        }
+
+        LineScan ScanLineScalar(const char *data, size_t size) {
+            return ScanScalar(data, 0, size, LineScan{});
+        }
+
+#ifdef SNOW_SCANNER_X86
+        inline unsigned LowestBit(std::uint32_t mask) {
+            return static_cast<unsigned>(__builtin_ctz(mask));
+        }
+
+        //把一个块的位掩码合并进扫描结果，找到行尾时返回true
+        //block中第i位对应data[pos + i]
+        inline bool ConsumeBlock(LineScan &r, size_t pos, std::uint32_t eol, std::uint32_t colon,
+                                 std::uint32_t ctl, std::uint32_t non_token) {
+            std::uint32_t before_eol = eol ? (eol & (0u - eol)) - 1 : ~0u;
+            if (r.ctl == npos && (ctl & before_eol)) {
+                r.ctl = pos + LowestBit(ctl & before_eol);
+            }
+            if (r.colon == npos) {
+                //tchar只检查到冒号为止，冒号之后是header的值
+                std::uint32_t token_range = before_eol;
+                if (colon & before_eol) {
+                    unsigned colon_bit = LowestBit(colon & before_eol);
+                    r.colon = pos + colon_bit;
+                    token_range &= (1u << colon_bit) - 1;
+                }
+                if (r.non_token == npos && (non_token & token_range)) {
+                    r.non_token = pos + LowestBit(non_token & token_range);
+                }
+            }
+            if (eol) {
+                r.line_end = pos + LowestBit(eol);
+                return true;
+            }
+            return false;
+        }
+
+        // tchar lookup by nibbles: row[lo] has bit h set when byte (h << 4 | lo) is a
+        // tchar, and kHighBit[h] selects that bit. Bytes >= 0x80 map to 0 and are never tokens.
+        struct NibbleTables {
+            alignas(32) std::uint8_t rows[32];
+            alignas(32) std::uint8_t high_bit[32];
+        };
+
+        constexpr NibbleTables MakeNibbleTables() {
+            NibbleTables t{};
+            for (unsigned lo = 0; lo < 16; ++lo) {
+                std::uint8_t row = 0;
+                for (unsigned hi = 0; hi < 8; ++hi) {
+                    if (IsTchar(hi << 4 | lo)) row |= static_cast<std::uint8_t>(1u << hi);
+                }
+                t.rows[lo] = t.rows[lo + 16] = row;
+                t.high_bit[lo] = t.high_bit[lo + 16] = lo < 8 ? static_cast<std::uint8_t>(1u << lo) : 0;
+            }
+            return t;
+        }
+
+        constexpr NibbleTables kNibbleTables = MakeNibbleTables();
+
+        __attribute__((target("sse4.2")))
+        LineScan ScanLineSse42(const char *data, size_t size) {
+            const __m128i cr = _mm_set1_epi8('\r');
+            const __m128i lf = _mm_set1_epi8('\n');
+            const __m128i colon = _mm_set1_epi8(':');
+            const __m128i tab = _mm_set1_epi8('\t');
+            const __m128i del = _mm_set1_epi8(0x7f);
+            const __m128i ctl_max = _mm_set1_epi8(0x1f);
+            const __m128i nibble = _mm_set1_epi8(0x0f);
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i rows = _mm_load_si128(reinterpret_cast<const __m128i *>(kNibbleTables.rows));
+            const __m128i high_bit = _mm_load_si128(reinterpret_cast<const __m128i *>(kNibbleTables.high_bit));
+
+            LineScan r;
+            size_t pos = 0;
+            for (; pos + 16 <= size; pos += 16) {
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+                __m128i eol = _mm_or_si128(_mm_cmpeq_epi8(b, cr), _mm_cmpeq_epi8(b, lf));
+                __m128i is_colon = _mm_cmpeq_epi8(b, colon);
+                __m128i ctl = _mm_andnot_si128(_mm_cmpeq_epi8(b, tab),
+                                               _mm_cmpeq_epi8(_mm_min_epu8(b, ctl_max), b));
+                ctl = _mm_or_si128(ctl, _mm_cmpeq_epi8(b, del));
+                __m128i lo = _mm_and_si128(b, nibble);
+                __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), nibble);
+                __m128i token = _mm_and_si128(_mm_shuffle_epi8(rows, lo), _mm_shuffle_epi8(high_bit, hi));
+                __m128i non_token = _mm_cmpeq_epi8(token, zero);
+
+                if (ConsumeBlock(r, pos,
+                                 static_cast<std::uint32_t>(_mm_movemask_epi8(eol)),
+                                 static_cast<std::uint32_t>(_mm_movemask_epi8(is_colon)),
+                                 static_cast<std::uint32_t>(_mm_movemask_epi8(ctl)),
+                                 static_cast<std::uint32_t>(_mm_movemask_epi8(non_token)))) {
+                    return r;
+                }
+            }
+            return ScanScalar(data, pos, size, r);
+        }
+
+        __attribute__((target("avx2")))
+        LineScan ScanLineAvx2(const char *data, size_t size) {
+            const __m256i cr = _mm256_set1_epi8('\r');
+            const __m256i lf = _mm256_set1_epi8('\n');
+            const __m256i colon = _mm256_set1_epi8(':');
+            const __m256i tab = _mm256_set1_epi8('\t');
+            const __m256i del = _mm256_set1_epi8(0x7f);
+            const __m256i ctl_max = _mm256_set1_epi8(0x1f);
+            const __m256i nibble = _mm256_set1_epi8(0x0f);
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i rows = _mm256_load_si256(reinterpret_cast<const __m256i *>(kNibbleTables.rows));
+            const __m256i high_bit = _mm256_load_si256(reinterpret_cast<const __m256i *>(kNibbleTables.high_bit));
+
+            LineScan r;
+            size_t pos = 0;
+            for (; pos + 32 <= size; pos += 32) {
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+                __m256i eol = _mm256_or_si256(_mm256_cmpeq_epi8(b, cr), _mm256_cmpeq_epi8(b, lf));
+                __m256i is_colon = _mm256_cmpeq_epi8(b, colon);
+                __m256i ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(b, tab),
+                                                  _mm256_cmpeq_epi8(_mm256_min_epu8(b, ctl_max), b));
+                ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(b, del));
+                __m256i lo = _mm256_and_si256(b, nibble);
+                __m256i hi = _mm256_and_si256(_mm256_srli_epi16(b, 4), nibble);
+                __m256i token = _mm256_and_si256(_mm256_shuffle_epi8(rows, lo),
+                                                 _mm256_shuffle_epi8(high_bit, hi));
+                __m256i non_token = _mm256_cmpeq_epi8(token, zero);
+
+                if (ConsumeBlock(r, pos,
+                                 static_cast<std::uint32_t>(_mm256_movemask_epi8(eol)),
+                                 static_cast<std::uint32_t>(_mm256_movemask_epi8(is_colon)),
+                                 static_cast<std::uint32_t>(_mm256_movemask_epi8(ctl)),
+                                 static_cast<std::uint32_t>(_mm256_movemask_epi8(non_token)))) {
+                    return r;
+                }
+            }
+            // Finish with one 16-byte step when possible before falling back to scalar.
+            if (pos + 16 <= size) {
+                LineScan tail = ScanLineSse42(data + pos, size - pos);
+                auto rebase = [pos](size_t offset) { return offset == npos ? npos : offset + pos; };
+                if (r.ctl == npos) r.ctl = rebase(tail.ctl);
+                if (r.colon == npos) {
+                    r.colon = rebase(tail.colon);
+                    if (r.non_token == npos) r.non_token = rebase(tail.non_token);
+                }
+                r.line_end = rebase(tail.line_end);
+                return r;
+            }
+            return ScanScalar(data, pos, size, r);
+        }
+#endif
+
+        struct Dispatch {
+            LineScan (*kernel)(const char *, size_t);
+            const char *name;
+        };
+
+        //只在第一次使用时检测一次CPU特性
+        const Dispatch &SelectKernel() {
+            static const Dispatch dispatch = [] {
+#ifdef SNOW_SCANNER_X86
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx2")) return Dispatch{ScanLineAvx2, "avx2"};
+                if (__builtin_cpu_supports("sse4.2")) return Dispatch{ScanLineSse42, "sse4.2"};
+#endif
+                return Dispatch{ScanLineScalar, "scalar"};
+            }();
+            return dispatch;
+        }
+    } // namespace
+
+    LineScan HttpScanner::ScanLine(const char *data, size_t size) {
+        return SelectKernel().kernel(data, size);
+    }
+
+    const char *HttpScanner::Implementation() {
+        return SelectKernel().name;
+    }
+}
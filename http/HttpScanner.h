@@ -0,0 +1,36 @@
+//HTTP报文的分隔符扫描
+//一次处理16(SSE4.2)或32(AVX2)字节，同时找出行尾、冒号和非法字节
+//运行时根据CPU特性选择实现，不支持的平台退回到查表的标量实现
+
+#ifndef HTTP_SCANNER_H
+#define HTTP_SCANNER_H
+
+#include <cstddef>
+#include <string_view>
+
+namespace snow {
+    //一行的扫描结果，所有位置都是相对于输入起点的偏移，找不到时为npos
+    struct LineScan {
+        static constexpr size_t npos = std::string_view::npos;
+
+        size_t line_end = npos;     //第一个'\r'或'\n'
+        size_t colon = npos;        //行尾之前的第一个':'
+        size_t ctl = npos;          //行尾之前的第一个控制字符(除HTAB)或DEL
+        size_t non_token = npos;    //冒号/行尾之前第一个不属于tchar(RFC 7230 3.2.6)的字节
+    };
+
+    class HttpScanner {
+    public:
+        //从data开始扫描到第一个行结束符为止
+        static LineScan ScanLine(const char *data, size_t size);
+
+        static LineScan ScanLine(std::string_view s) {
+            return ScanLine(s.data(), s.size());
+        }
+
+        //当前使用的实现："avx2"、"sse4.2"或"scalar"
+        static const char *Implementation();
+    };
+}
+
+#endif
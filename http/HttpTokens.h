@@ -0,0 +1,283 @@
+//请求方法、协议版本和常用header名与枚举之间的双向映射
+//查找表在编译期生成：为每组token找到一个无冲突的(完美)哈希，查找只需要几条指令加一次比较，不分配内存
+
+#ifndef HTTP_TOKENS_H
+#define HTTP_TOKENS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "http_message.h"
+
+namespace snow {
+
+    //常用的header，HeaderName()给出它们的标准写法
+    enum class HttpHeader {
+        Accept,
+        AcceptEncoding,
+        AcceptLanguage,
+        AcceptRanges,
+        Authorization,
+        CacheControl,
+        Connection,
+        ContentEncoding,
+        ContentLength,
+        ContentRange,
+        ContentType,
+        Cookie,
+        Date,
+        ETag,
+        Expect,
+        Host,
+        IfMatch,
+        IfModifiedSince,
+        IfNoneMatch,
+        IfRange,
+        LastModified,
+        Location,
+        Range,
+        Referer,
+        Server,
+        SetCookie,
+        TransferEncoding,
+        Upgrade,
+        UserAgent,
+        Vary,
+        XForwardedFor
+    };
+
+    //只转换ASCII字母，和std::tolower不同，不依赖locale
+    constexpr char FoldCase(char c) {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    constexpr bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (FoldCase(a[i]) != FoldCase(b[i])) return false;
+        }
+        return true;
+    }
+
+    template<typename Enum>
+    struct Token {
+        std::string_view name;
+        Enum value;
+    };
+
+    // A constant set of tokens with a collision-free hash, built by the constructor
+    // at compile time.
+    //
+    // A token's key is its length plus one byte counted from the front and one from
+    // the back (case folded). The constructor searches for the two positions that
+    // tell every token in this set apart, then for a multiplier that sends every key
+    // to its own slot. Find() therefore computes one key, one multiply and shift,
+    // and a single case-insensitive compare against the only possible candidate.
+    //
+    // The reverse direction indexes a second table by the enum's value, which must
+    // also fit collision-free in kSlots; the constructor checks that too. Because
+    // the tables are constexpr objects, a token set the search cannot separate is a
+    // compile error rather than a runtime surprise.
+    template<typename Enum, size_t Count>
+    class TokenTable {
+    public:
+        static_assert(Count > 0 && Count < 64, "slots are indexed with one byte");
+
+        constexpr explicit TokenTable(const Token<Enum> (&tokens)[Count]) : tokens_() {
+            for (size_t i = 0; i < Count; ++i) {
+                tokens_[i] = tokens[i];
+                if (tokens[i].name.empty()) throw "empty token";
+            }
+            if (!ChoosePositions() || !ChooseSeed()) {
+                throw "no perfect hash found for this token set";
+            }
+            for (size_t i = 0; i < Count; ++i) {
+                size_t slot = static_cast<size_t>(tokens_[i].value) & (kSlots - 1);
+                if (names_[slot] != 0) throw "enum values collide in the reverse table";
+                names_[slot] = static_cast<std::uint8_t>(i + 1);
+            }
+        }
+
+        constexpr std::optional<Enum> Find(std::string_view token) const {
+            if (token.empty()) {
+                return std::nullopt;
+            }
+            std::uint8_t index = slots_[Slot(Key(token, front_, back_), seed_)];
+            if (index == 0 || !EqualsIgnoreCase(tokens_[index - 1].name, token)) {
+                return std::nullopt;
+            }
+            return tokens_[index - 1].value;
+        }
+
+        //value不在表中时返回空
+        constexpr std::string_view Name(Enum value) const {
+            std::uint8_t index = names_[static_cast<size_t>(value) & (kSlots - 1)];
+            if (index == 0 || tokens_[index - 1].value != value) {
+                return {};
+            }
+            return tokens_[index - 1].name;
+        }
+
+    private:
+        //至少是token数的4倍，这样很快就能找到无冲突的乘数
+        static constexpr size_t kSlots = [] {
+            size_t slots = 1;
+            while (slots < Count * 4) slots <<= 1;
+            return slots;
+        }();
+        static constexpr unsigned kSlotBits = [] {
+            unsigned bits = 0;
+            while ((size_t{1} << bits) < kSlots) ++bits;
+            return bits;
+        }();
+        static constexpr size_t kMaxPosition = 8;
+
+        std::array<Token<Enum>, Count> tokens_;
+        std::array<std::uint8_t, kSlots> slots_{};     //token下标+1，0表示空
+        std::array<std::uint8_t, kSlots> names_{};     //按枚举值索引，token下标+1
+        size_t front_ = 0;
+        size_t back_ = 0;
+        std::uint32_t seed_ = 0;
+
+        static constexpr std::uint32_t Key(std::string_view token, size_t front, size_t back) {
+            size_t last = token.size() - 1;
+            auto at = [&](size_t i) { return static_cast<std::uint32_t>(static_cast<unsigned char>(FoldCase(token[i]))); };
+            return static_cast<std::uint32_t>(token.size() & 0xff) |
+                   at(front < last ? front : last) << 8 |
+                   at(last - (back < last ? back : last)) << 16;
+        }
+
+        static constexpr size_t Slot(std::uint32_t key, std::uint32_t seed) {
+            return static_cast<size_t>((key * seed) >> (32 - kSlotBits));
+        }
+
+        constexpr bool ChoosePositions() {
+            for (front_ = 0; front_ < kMaxPosition; ++front_) {
+                for (back_ = 0; back_ < kMaxPosition; ++back_) {
+                    bool distinct = true;
+                    for (size_t i = 0; i < Count && distinct; ++i) {
+                        for (size_t j = 0; j < i && distinct; ++j) {
+                            distinct = Key(tokens_[i].name, front_, back_) != Key(tokens_[j].name, front_, back_);
+                        }
+                    }
+                    if (distinct) return true;
+                }
+            }
+            return false;
+        }
+
+        constexpr bool ChooseSeed() {
+            //奇数乘数，从黄金分割常数开始依次尝试
+            for (std::uint32_t seed = 0x9e3779b1u, tries = 0; tries < 100000; seed += 2, ++tries) {
+                std::array<std::uint8_t, kSlots> slots{};
+                bool collision = false;
+                for (size_t i = 0; i < Count && !collision; ++i) {
+                    size_t slot = Slot(Key(tokens_[i].name, front_, back_), seed);
+                    collision = slots[slot] != 0;
+                    slots[slot] = static_cast<std::uint8_t>(i + 1);
+                }
+                if (!collision) {
+                    slots_ = slots;
+                    seed_ = seed;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    namespace tokens {
+        inline constexpr Token<HttpMethod> kMethods[] = {
+                {"GET",     HttpMethod::GET},
+                {"HEAD",    HttpMethod::HEAD},
+                {"POST",    HttpMethod::POST},
+                {"PUT",     HttpMethod::PUT},
+                {"DELETE",  HttpMethod::DELETE},
+                {"CONNECT", HttpMethod::CONNECT},
+                {"OPTIONS", HttpMethod::OPTIONS},
+                {"TRACE",   HttpMethod::TRACE},
+                {"PATCH",   HttpMethod::PATCH},
+        };
+
+        inline constexpr Token<HttpVersion> kVersions[] = {
+                {"HTTP/0.9", HttpVersion::HTTP_0_9},
+                {"HTTP/1.0", HttpVersion::HTTP_1_0},
+                {"HTTP/1.1", HttpVersion::HTTP_1_1},
+                {"HTTP/2.0", HttpVersion::HTTP_2_0},
+        };
+
+        inline constexpr Token<HttpHeader> kHeaders[] = {
+                {"Accept",              HttpHeader::Accept},
+                {"Accept-Encoding",     HttpHeader::AcceptEncoding},
+                {"Accept-Language",     HttpHeader::AcceptLanguage},
+                {"Accept-Ranges",       HttpHeader::AcceptRanges},
+                {"Authorization",       HttpHeader::Authorization},
+                {"Cache-Control",       HttpHeader::CacheControl},
+                {"Connection",          HttpHeader::Connection},
+                {"Content-Encoding",    HttpHeader::ContentEncoding},
+                {"Content-Length",      HttpHeader::ContentLength},
+                {"Content-Range",       HttpHeader::ContentRange},
+                {"Content-Type",        HttpHeader::ContentType},
+                {"Cookie",              HttpHeader::Cookie},
+                {"Date",                HttpHeader::Date},
+                {"ETag",                HttpHeader::ETag},
+                {"Expect",              HttpHeader::Expect},
+                {"Host",                HttpHeader::Host},
+                {"If-Match",            HttpHeader::IfMatch},
+                {"If-Modified-Since",   HttpHeader::IfModifiedSince},
+                {"If-None-Match",       HttpHeader::IfNoneMatch},
+                {"If-Range",            HttpHeader::IfRange},
+                {"Last-Modified",       HttpHeader::LastModified},
+                {"Location",            HttpHeader::Location},
+                {"Range",               HttpHeader::Range},
+                {"Referer",             HttpHeader::Referer},
+                {"Server",              HttpHeader::Server},
+                {"Set-Cookie",          HttpHeader::SetCookie},
+                {"Transfer-Encoding",   HttpHeader::TransferEncoding},
+                {"Upgrade",             HttpHeader::Upgrade},
+                {"User-Agent",          HttpHeader::UserAgent},
+                {"Vary",                HttpHeader::Vary},
+                {"X-Forwarded-For",     HttpHeader::XForwardedFor},
+        };
+
+        inline constexpr TokenTable kMethodTable(kMethods);
+        inline constexpr TokenTable kVersionTable(kVersions);
+        inline constexpr TokenTable kHeaderTable(kHeaders);
+    } // namespace tokens
+
+    //大小写不敏感，和之前的string_to_method一致
+    constexpr std::optional<HttpMethod> LookupMethod(std::string_view token) {
+        return tokens::kMethodTable.Find(token);
+    }
+
+    constexpr std::optional<HttpVersion> LookupVersion(std::string_view token) {
+        return tokens::kVersionTable.Find(token);
+    }
+
+    constexpr std::optional<HttpHeader> LookupHeader(std::string_view name) {
+        return tokens::kHeaderTable.Find(name);
+    }
+
+    constexpr std::string_view MethodName(HttpMethod method) {
+        return tokens::kMethodTable.Name(method);
+    }
+
+    constexpr std::string_view VersionName(HttpVersion version) {
+        return tokens::kVersionTable.Name(version);
+    }
+
+    constexpr std::string_view HeaderName(HttpHeader header) {
+        return tokens::kHeaderTable.Name(header);
+    }
+
+    static_assert(LookupMethod("GET") == HttpMethod::GET && LookupMethod("patch") == HttpMethod::PATCH &&
+                  !LookupMethod("GETS"));
+    static_assert(LookupVersion("HTTP/1.1") == HttpVersion::HTTP_1_1 && !LookupVersion("HTTP/1.2"));
+    static_assert(LookupHeader("content-length") == HttpHeader::ContentLength &&
+                  HeaderName(HttpHeader::IfRange) == "If-Range");
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include "RequestArena.h"
+
+namespace snow {
+    namespace {
+        //每个线程一块可复用的初始缓冲区，请求处理期间被这个线程上的arena独占
+        alignas(std::max_align_t) thread_local std::byte inline_buffer[RequestArena::kInlineBufferSize];
+        thread_local bool inline_buffer_in_use = false;
+    } // namespace
+
+    RequestArena::RequestArena() : owns_inline_buffer_(!inline_buffer_in_use),
+                                   resource_(owns_inline_buffer_
+                                             ? std::pmr::monotonic_buffer_resource(
+                                                     inline_buffer, sizeof(inline_buffer),
+                                                     std::pmr::new_delete_resource())
+                                             : std::pmr::monotonic_buffer_resource(
+                                                     kInlineBufferSize, std::pmr::new_delete_resource())) {
+        if (owns_inline_buffer_) {
+            inline_buffer_in_use = true;
+        }
+    }
+
+    RequestArena::~RequestArena() {
+        //超出缓冲区后申请的块在这里统一释放，仍然在分配它们的线程上
+        resource_.release();
+        if (owns_inline_buffer_) {
+            inline_buffer_in_use = false;
+        }
+    }
+}
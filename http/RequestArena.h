@@ -0,0 +1,40 @@
+//每个请求一个的单调分配arena
+//HttpRequest/HttpResponse中的header、body、Uri都从arena分配，分配只是移动指针，
+//请求处理完后arena析构时一次性释放，不存在逐个free，也不会把内存释放到别的线程
+
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "http_message.h"
+
+namespace snow {
+    class RequestArena {
+    public:
+        //线程本地缓冲区的大小，一般的请求和响应都能完全放在里面
+        static constexpr size_t kInlineBufferSize = 16 * 1024;
+
+        RequestArena();
+
+        ~RequestArena();
+
+        RequestArena(const RequestArena &) = delete;
+
+        RequestArena &operator=(const RequestArena &) = delete;
+
+        HttpMessageInterface::allocator_type allocator() {
+            return HttpMessageInterface::allocator_type(&resource_);
+        }
+
+        std::pmr::memory_resource *resource() { return &resource_; }
+
+    private:
+        //是否占用了线程本地缓冲区，同一线程上嵌套的arena只能从上游分配
+        bool owns_inline_buffer_;
+        std::pmr::monotonic_buffer_resource resource_;
+    };
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "ResponseWriter.h"
+
+#include <charconv>
+#include <stdexcept>
+
+namespace snow {
+    ResponseWriter::ResponseWriter(std::string *out, std::string_view fixed_headers, bool send_content)
+            : out_(out), fixed_headers_(fixed_headers), send_content_(send_content) {}
+
+    void ResponseWriter::Status(HttpStatusCode code) {
+        if (stage_ != Stage::kStatus) {
+            throw std::logic_error("response status already written");
+        }
+        status_ = code;
+    }
+
+    void ResponseWriter::Header(std::string_view name, std::string_view value) {
+        if (stage_ == Stage::kDone) {
+            throw std::logic_error("response headers already ended");
+        }
+        WriteStatusLine();
+        out_->append(name).append(": ").append(value).append("\r\n");
+    }
+
+    void ResponseWriter::Body(std::string_view body) {
+        EndHeaders(body.size());
+        if (send_content_) {
+            out_->append(body);
+        }
+    }
+
+    char *ResponseWriter::BodyBuffer(size_t length) {
+        EndHeaders(length);
+        //HEAD请求也给handler一块可写的内存，Finish()时再去掉
+        out_->resize(body_start_ + length);
+        return out_->data() + body_start_;
+    }
+
+    void ResponseWriter::Finish() {
+        if (stage_ != Stage::kDone) {
+            EndHeaders(0);
+        }
+        if (!send_content_) {
+            out_->resize(body_start_);
+        }
+    }
+
+    void ResponseWriter::WriteStatusLine() {
+        if (stage_ != Stage::kStatus) {
+            return;
+        }
+        char code[4];
+        auto result = std::to_chars(code, code + sizeof(code), static_cast<int>(status_));
+        out_->append(VersionName(HttpVersion::HTTP_1_1)).append(" ")
+                .append(code, result.ptr).append(" ")
+                .append(HttpUtility::To_String(status_)).append("\r\n");
+        stage_ = Stage::kHeaders;
+    }
+
+    void ResponseWriter::EndHeaders(size_t content_length) {
+        if (stage_ == Stage::kDone) {
+            throw std::logic_error("response body already written");
+        }
+        WriteStatusLine();
+        char length[24];
+        auto result = std::to_chars(length, length + sizeof(length), content_length);
+        out_->append(HeaderName(HttpHeader::ContentLength)).append(": ")
+                .append(length, result.ptr).append("\r\n")
+                .append(fixed_headers_).append("\r\n");
+        body_start_ = out_->size();
+        stage_ = Stage::kDone;
+    }
+}
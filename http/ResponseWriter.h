@@ -0,0 +1,81 @@
+//把响应直接序列化到连接的输出缓冲区：状态行、header和body按顺序追加，
+//不经过HttpResponse，不需要header map，也不需要再拷贝一次body
+
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "http_message.h"
+#include "HttpTokens.h"
+
+namespace snow {
+    // Streams one HTTP/1.1 response into a string the caller owns.
+    //
+    // Calls go in wire order: an optional Status(), any number of Header(), then
+    // Body() or BodyBuffer() once. The status line is written lazily, so Status()
+    // may be skipped for 200; headers cannot be taken back once written, and calls
+    // out of order throw std::logic_error. Content-Length is always written by the
+    // writer, from the body's size, so a handler must not add it itself.
+    //
+    // Finish() closes a response that has no body yet and, for HEAD, drops the
+    // body bytes again while keeping their Content-Length.
+    class ResponseWriter {
+    public:
+        //fixed_headers是已经序列化好的header行(每行以"\r\n"结尾)，在header结束前追加，
+        //服务端用它加上"Connection: close"；send_content为false时只发送header(HEAD请求)
+        explicit ResponseWriter(std::string *out, std::string_view fixed_headers = {}, bool send_content = true);
+
+        ResponseWriter(const ResponseWriter &) = delete;
+
+        ResponseWriter &operator=(const ResponseWriter &) = delete;
+
+        void Status(HttpStatusCode code);
+
+        void Header(std::string_view name, std::string_view value);
+
+        void Header(HttpHeader name, std::string_view value) {
+            Header(HeaderName(name), value);
+        }
+
+        //写入整个body并结束响应
+        void Body(std::string_view body);
+
+        //为length字节的body预留空间并结束header，返回写入位置，
+        //用于直接在缓冲区里生成body(格式化、序列化等)，避免先生成一个临时字符串
+        char *BodyBuffer(size_t length);
+
+        //没有调用过Body/BodyBuffer时以空body结束响应，可以重复调用
+        void Finish();
+
+        HttpStatusCode status() const { return status_; }
+
+        //已经开始写入(之后不能再改成另一个响应)
+        bool started() const { return stage_ != Stage::kStatus; }
+
+        bool finished() const { return stage_ == Stage::kDone; }
+
+    private:
+        enum class Stage {
+            kStatus,    //状态行还没有写出
+            kHeaders,
+            kDone
+        };
+
+        std::string *out_;
+        std::string_view fixed_headers_;
+        bool send_content_;
+        HttpStatusCode status_ = HttpStatusCode::Ok;
+        Stage stage_ = Stage::kStatus;
+        size_t body_start_ = 0;
+
+        void WriteStatusLine();
+
+        //写出Content-Length和fixed_headers_，结束header
+        void EndHeaders(size_t content_length);
+    };
+}
+
+#endif // RESPONSE_WRITER_H
@@ -1,55 +1,289 @@
 #include "Uri.h"
 #include <cstdint>
-#include <sstream>
+#include <stdexcept>
 #include <string>
 
 namespace snow {
-    Uri::Uri(const std::string &uri_str) {
-        std::istringstream ss(uri_str);
-        std::string temp;
-        //1. 解析scheme
-        if (std::getline(ss, temp, ':')) {
-            scheme_ = temp;
-            //跳过"//"
-            if (ss.peek() == '/') ss.get();
-            if (ss.peek() == '/') ss.get();
-        } else {
-            throw std::invalid_argument("Invalid URI: Missing scheme");
-        }
-        //2. 解析host和port
-        if (std::getline(ss, temp, '/')) {
-            auto pos = temp.find(':');
-            if (pos != std::string::npos) {
-                host_ = temp.substr(0, pos);
-                port_ = static_cast<uint16_t>(std::stoi(temp.substr(pos + 1)));
+    namespace {
+        //十六进制字符转数值，非法字符返回-1
+        int HexValue(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        bool IsUnreserved(unsigned char c) {
+            return std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+        }
+
+        bool IsSchemeChar(unsigned char c) {
+            return std::isalnum(c) || c == '+' || c == '-' || c == '.';
+        }
+
+        //URI中不允许出现控制字符、空格和DEL
+        bool IsForbidden(unsigned char c) {
+            return c <= 0x20 || c == 0x7f;
+        }
+
+        //解析authority部分: [userinfo@]host[:port]，host可以是IPv6字面量
+        bool ParseAuthority(std::string_view authority, UriView *out) {
+            size_t at = authority.rfind('@');
+            if (at != std::string_view::npos) {
+                authority.remove_prefix(at + 1);
+            }
+            size_t port_sep;
+            if (!authority.empty() && authority.front() == '[') {
+                size_t close = authority.find(']');
+                if (close == std::string_view::npos) return false;
+                out->host = authority.substr(0, close + 1);
+                port_sep = close + 1;
+                if (port_sep < authority.size() && authority[port_sep] != ':') return false;
             } else {
-                host_ = temp;
-                //目前只支持http
-                if (scheme_ == "http") {
-                    port_ = 80;
-                } else {
-                    port_ = 0;//未知
+                port_sep = authority.find(':');
+                out->host = authority.substr(0, port_sep);
+            }
+            if (port_sep < authority.size()) {
+                out->port = authority.substr(port_sep + 1);
+                if (out->port.size() > 5) return false;
+                for (char c : out->port) {
+                    if (c < '0' || c > '9') return false;
+                }
+            }
+            return true;
+        }
+
+        //从authority之后的位置开始解析path、query和fragment，每个字节只访问一次
+        bool ParsePathQueryFragment(std::string_view input, size_t pos, UriView *out) {
+            size_t path_begin = pos;
+            size_t query_begin = std::string_view::npos;
+            for (; pos < input.size(); ++pos) {
+                unsigned char c = input[pos];
+                if (IsForbidden(c)) return false;
+                if (c == '?' && query_begin == std::string_view::npos) {
+                    out->path = input.substr(path_begin, pos - path_begin);
+                    query_begin = pos + 1;
+                } else if (c == '#') {
+                    break;
                 }
             }
+            if (query_begin == std::string_view::npos) {
+                out->path = input.substr(path_begin, pos - path_begin);
+            } else {
+                out->query = input.substr(query_begin, pos - query_begin);
+            }
+            if (pos < input.size()) {
+                out->fragment = input.substr(pos + 1);
+                for (unsigned char c : out->fragment) {
+                    if (IsForbidden(c)) return false;
+                }
+            }
+            return true;
+        }
+
+        std::uint16_t DefaultPort(std::string_view scheme) {
+            if (scheme == "http") return 80;
+            if (scheme == "https") return 443;
+            return 0;//未知
+        }
+    } // namespace
+
+    bool ParseUri(std::string_view input, UriView *out) {
+        *out = UriView{};
+        //1. 解析scheme
+        size_t pos = 0;
+        if (input.empty() || !std::isalpha(static_cast<unsigned char>(input[0]))) return false;
+        while (pos < input.size() && IsSchemeChar(static_cast<unsigned char>(input[pos]))) ++pos;
+        if (pos == input.size() || input[pos] != ':') return false;
+        out->scheme = input.substr(0, pos);
+        ++pos;
+        //2. 解析authority，只有以"//"开头时才存在
+        if (input.substr(pos, 2) == "//") {
+            pos += 2;
+            size_t end = pos;
+            while (end < input.size() && input[end] != '/' && input[end] != '?' && input[end] != '#') {
+                if (IsForbidden(static_cast<unsigned char>(input[end]))) return false;
+                ++end;
+            }
+            if (!ParseAuthority(input.substr(pos, end - pos), out)) return false;
+            pos = end;
+        }
+        //3. 解析path、query和fragment
+        return ParsePathQueryFragment(input, pos, out);
+    }
+
+    bool ParseRequestTarget(std::string_view target, UriView *out) {
+        *out = UriView{};
+        if (target.empty()) return false;
+        //origin-form，绝大多数请求都是这种形式
+        if (target.front() == '/') {
+            return ParsePathQueryFragment(target, 0, out) && out->fragment.empty();
+        }
+        //asterisk-form，只用于OPTIONS
+        if (target == "*") {
+            out->path = target;
+            return true;
+        }
+        //absolute-form，用于发往代理的请求
+        if (target.find("://") != std::string_view::npos) {
+            return ParseUri(target, out) && out->fragment.empty();
+        }
+        //authority-form，只用于CONNECT
+        for (unsigned char c : target) {
+            if (IsForbidden(c) || c == '/' || c == '?' || c == '#') return false;
+        }
+        return ParseAuthority(target, out) && !out->port.empty();
+    }
+
+    std::string QueryView::Param::name() const {
+        std::string decoded;
+        if (!UriNormalizer::PercentDecode(raw_name, &decoded, true)) return std::string(raw_name);
+        return decoded;
+    }
+
+    std::string QueryView::Param::value() const {
+        std::string decoded;
+        if (!UriNormalizer::PercentDecode(raw_value, &decoded, true)) return std::string(raw_value);
+        return decoded;
+    }
+
+    QueryView::Param QueryView::NextParam(std::string_view *rest) {
+        size_t amp = rest->find('&');
+        std::string_view pair = rest->substr(0, amp);
+        rest->remove_prefix(amp == std::string_view::npos ? rest->size() : amp + 1);
+
+        size_t eq = pair.find('=');
+        if (eq == std::string_view::npos) {
+            return Param{pair, std::string_view{}};
+        }
+        return Param{pair.substr(0, eq), pair.substr(eq + 1)};
+    }
+
+    std::optional<QueryView::Param> QueryView::Find(std::string_view name) const {
+        std::optional<Param> found;
+        ForEach([&](const Param &param) {
+            //参数名没有编码时直接比较，不需要解码
+            bool encoded = param.raw_name.find_first_of("%+") != std::string_view::npos;
+            if (encoded ? param.name() == name : param.raw_name == name) {
+                found = param;
+                return false;
+            }
+            return true;
+        });
+        return found;
+    }
+
+    std::optional<std::string> QueryView::Get(std::string_view name) const {
+        std::optional<Param> param = Find(name);
+        if (!param) return std::nullopt;
+        return param->value();
+    }
+
+    bool UriNormalizer::PercentDecode(std::string_view in, std::string *out, bool plus_as_space) {
+        out->clear();
+        out->reserve(in.size());
+        for (size_t i = 0; i < in.size(); ++i) {
+            char c = in[i];
+            if (c == '%') {
+                if (i + 2 >= in.size()) return false;
+                int hi = HexValue(in[i + 1]);
+                int lo = HexValue(in[i + 2]);
+                if (hi < 0 || lo < 0) return false;
+                out->push_back(static_cast<char>(hi << 4 | lo));
+                i += 2;
+            } else if (c == '+' && plus_as_space) {
+                out->push_back(' ');
+            } else {
+                out->push_back(c);
+            }
         }
-        //3.解析path
-        if (ss.rdbuf()->in_avail() > 0) {
-            std::getline(ss, path_);
-            path_ = "/" + path_;
-        } else {
-            path_ = "/";
+        return true;
+    }
+
+    std::string UriNormalizer::RemoveDotSegments(std::string_view path) {
+        std::string output;
+        output.reserve(path.size());
+        while (!path.empty()) {
+            //A. 去掉前缀"../"或"./"
+            if (path.substr(0, 3) == "../") {
+                path.remove_prefix(3);
+            } else if (path.substr(0, 2) == "./") {
+                path.remove_prefix(2);
+            //B. "/./"或结尾的"/."替换为"/"
+            } else if (path.substr(0, 3) == "/./") {
+                path.remove_prefix(2);
+            } else if (path == "/.") {
+                path = "/";
+            //C. "/../"或结尾的"/.."替换为"/"，并删除output中的最后一段
+            } else if (path.substr(0, 4) == "/../" || path == "/..") {
+                path = path.size() == 3 ? std::string_view("/") : path.substr(3);
+                size_t last = output.rfind('/');
+                output.erase(last == std::string::npos ? 0 : last);
+            //D. 只剩"."或".."
+            } else if (path == "." || path == "..") {
+                path = std::string_view{};
+            //E. 把第一段移入output
+            } else {
+                size_t next = path.find('/', 1);
+                output.append(path.substr(0, next));
+                path.remove_prefix(next == std::string_view::npos ? path.size() : next);
+            }
+        }
+        return output;
+    }
+
+    bool UriNormalizer::NormalizePath(std::string_view raw_path, std::string *out) {
+        static const char kHex[] = "0123456789ABCDEF";
+        std::string decoded;
+        decoded.reserve(raw_path.size());
+        for (size_t i = 0; i < raw_path.size(); ++i) {
+            if (raw_path[i] != '%') {
+                decoded.push_back(raw_path[i]);
+                continue;
+            }
+            if (i + 2 >= raw_path.size()) return false;
+            int hi = HexValue(raw_path[i + 1]);
+            int lo = HexValue(raw_path[i + 2]);
+            if (hi < 0 || lo < 0) return false;
+            unsigned char c = static_cast<unsigned char>(hi << 4 | lo);
+            //只有unreserved字符可以安全解码，"%2F"之类解码后会改变path的结构
+            if (IsUnreserved(c)) {
+                decoded.push_back(static_cast<char>(c));
+            } else {
+                decoded.push_back('%');
+                decoded.push_back(kHex[hi]);
+                decoded.push_back(kHex[lo]);
+            }
+            i += 2;
         }
+        *out = RemoveDotSegments(decoded);
+        if (out->empty()) *out = "/";
+        return true;
     }
 
+    Uri::Uri(const UriView &view, allocator_type alloc)
+            : scheme_(view.scheme, alloc),
+              host_(view.host, alloc),
+              port_(DefaultPort(view.scheme)),
+              path_(view.path.empty() ? std::string_view("/") : view.path, alloc),
+              query_(view.query, alloc),
+              fragment_(view.fragment, alloc) {
+        if (!view.port.empty()) {
+            unsigned long port = std::stoul(std::string(view.port));
+            if (port > UINT16_MAX) {
+                throw std::invalid_argument("Invalid URI port: " + std::string(view.port));
+            }
+            port_ = static_cast<std::uint16_t>(port);
+        }
+        UriNormalizer::NormalizeSchemeHost(scheme_, host_);
+    }
 
-// // 测试
-// int main() {
-//     Uri uri("http://example.com:8080/path/to/resource");
+    Uri::Uri(const std::string &uri_str) {
+        UriView view;
+        if (!ParseUri(uri_str, &view)) {
+            throw std::invalid_argument("Invalid URI: " + uri_str);
+        }
+        *this = Uri(view);
+    }
 
-//     std::cout << "Scheme: " << uri.getScheme() << "\n";
-//     std::cout << "Host: " << uri.getHost() << "\n";
-//     std::cout << "Port: " << uri.getPort() << "\n";
-//     std::cout << "Path: " << uri.getPath() << "\n";
-//     return 0;
-// }
 }
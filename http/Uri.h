@@ -11,47 +11,125 @@
 
 #include <cctype>
 #include <cstdint>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <algorithm>
 
 namespace snow {
+    //Uri各部分的视图，全部指向被解析的原始字符串，不拥有内存
+    //原始字符串的生命周期必须长于UriView
+    struct UriView {
+        std::string_view scheme;
+        std::string_view host;
+        std::string_view port;      //未经转换的端口号文本，可能为空
+        std::string_view path;
+        std::string_view query;     //不包含'?'
+        std::string_view fragment;  //不包含'#'
+    };
+
+    //单趟解析absolute URI，例如 http://example.com:8080/path?x=1#top
+    //不分配内存，格式错误时返回false
+    bool ParseUri(std::string_view input, UriView *out);
+
+    //解析请求行中的request-target (RFC 7230 5.3)：
+    //origin-form "/path?query"、absolute-form、authority-form "host:port" 和 asterisk-form "*"
+    bool ParseRequestTarget(std::string_view target, UriView *out);
+
+    //惰性的query参数访问器：只保存原始query，只有在访问某个参数时才做percent-decoding
+    class QueryView {
+    public:
+        //一个未解码的参数，name/value指向原始query
+        struct Param {
+            std::string_view raw_name;
+            std::string_view raw_value;
+
+            std::string name() const;
+
+            std::string value() const;
+        };
+
+        QueryView() = default;
+
+        explicit QueryView(std::string_view query) : query_(query) {}
+
+        bool empty() const { return query_.empty(); }
+
+        bool Has(std::string_view name) const { return Find(name).has_value(); }
+
+        //返回第一个名为name的参数解码后的值
+        std::optional<std::string> Get(std::string_view name) const;
+
+        //按出现顺序遍历所有参数，fn返回false时停止
+        template<class Fn>
+        void ForEach(Fn &&fn) const {
+            std::string_view rest = query_;
+            while (!rest.empty()) {
+                Param param = NextParam(&rest);
+                if (param.raw_name.empty() && param.raw_value.empty()) continue;
+                if (!fn(param)) return;
+            }
+        }
+
+    private:
+        std::string_view query_;
+
+        std::optional<Param> Find(std::string_view name) const;
+
+        static Param NextParam(std::string_view *rest);
+    };
+
     class Uri {
     public:
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
         explicit Uri(const std::string &uri_str);
 
+        explicit Uri(const UriView &view, allocator_type alloc = {});
+
         Uri() = default;
 
+        explicit Uri(allocator_type alloc)
+                : scheme_(alloc), host_(alloc), path_(alloc), query_(alloc), fragment_(alloc) {}
+
         ~Uri() = default;
 
         //get function
-        std::string getScheme() const { return scheme_; }
+        std::string_view getScheme() const { return scheme_; }
 
-        std::string getHost() const { return host_; }
+        std::string_view getHost() const { return host_; }
 
         std::uint16_t getPort() const { return port_; }
 
-        std::string getPath() const { return path_; }
+        std::string_view getPath() const { return path_; }
 
-        std::string getQuery() const { return query_; }
+        std::string_view getQuery() const { return query_; }
 
-        std::string getFragment() const { return fragment_; }
+        std::string_view getFragment() const { return fragment_; }
 
-        void setPath(const std::string &path) { path_ = std::move(path_); }
+        //query参数的惰性视图，指向本对象内部，Uri被修改或销毁后失效
+        QueryView getQueryParams() const { return QueryView(query_); }
+
+        void setPath(std::string_view path) { path_.assign(path); }
+
+        void setQuery(std::string_view query) { query_.assign(query); }
 
     private:
-        std::string scheme_;
-        std::string host_;
-        std::uint16_t port_;
-        std::string path_;
-        std::string query_;
-        std::string fragment_;
+        std::pmr::string scheme_;
+        std::pmr::string host_;
+        std::uint16_t port_ = 0;
+        std::pmr::string path_;
+        std::pmr::string query_;
+        std::pmr::string fragment_;
     };
 
     //Uri个个部分规范工具类
     class UriNormalizer {
     public:
         //强制小写化scheme和host(RFC 3986)
-        static void NormalizeSchemeHost(std::string &scheme, std::string &host) {
+        template<class String>
+        static void NormalizeSchemeHost(String &scheme, String &host) {
             ToLower(scheme);
             ToLower(host);
         }
@@ -70,11 +148,28 @@ namespace snow {
             }
         }
 
+        //RFC 3986 6.2.2的path规范化：解码unreserved字符的percent编码，
+        //其余percent编码统一为大写十六进制，然后移除"."和".."段
+        //遇到格式错误的percent编码时返回false
+        static bool NormalizePath(std::string_view raw_path, std::string *out);
+
+        //path中没有percent编码也没有点段时已经是规范形式，可以跳过NormalizePath
+        static bool NeedsNormalization(std::string_view raw_path) {
+            return raw_path.find('%') != std::string_view::npos || raw_path.find("/.") != std::string_view::npos;
+        }
+
+        //RFC 3986 5.2.4 remove_dot_segments
+        static std::string RemoveDotSegments(std::string_view path);
+
+        //完整的percent-decoding，plus_as_space用于application/x-www-form-urlencoded的query
+        static bool PercentDecode(std::string_view in, std::string *out, bool plus_as_space = false);
+
     private:
-        static void ToLower(std::string &s) {
+        template<class String>
+        static void ToLower(String &s) {
             std::transform(s.begin(), s.end(), s.begin(),
                            [](unsigned char c) { return std::tolower(c); });
         }
     };
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,48 +1,17 @@
 #include "http_message.h"
-#include <cctype>
+#include "HttpScanner.h"
+#include "HttpTokens.h"
 #include <cstddef>
 #include <sstream>
 #include <stdexcept>
 
 namespace snow {
     std::string HttpUtility::To_String(HttpVersion version) {
-        switch (version) {
-            case HttpVersion::HTTP_0_9:
-                return "HTTP/0.9";
-            case HttpVersion::HTTP_1_0:
-                return "HTTP/1.0";
-            case HttpVersion::HTTP_1_1:
-                return "HTTP/1.1";
-            case HttpVersion::HTTP_2_0:
-                return "HTTP/2.0";
-            default:
-                return std::string{};
-        }
+        return std::string(VersionName(version));
     }
 
     std::string HttpUtility::To_String(HttpMethod method) {
-        switch (method) {
-            case HttpMethod::GET:
-                return "GET";
-            case HttpMethod::HEAD:
-                return "HEAD";
-            case HttpMethod::POST:
-                return "POST";
-            case HttpMethod::PUT:
-                return "PUT";
-            case HttpMethod::DELETE:
-                return "DELETE";
-            case HttpMethod::CONNECT:
-                return "CONNECT";
-            case HttpMethod::OPTIONS:
-                return "OPTIONS";
-            case HttpMethod::TRACE:
-                return "TRACE";
-            case HttpMethod::PATCH:
-                return "PATCH";
-            default:
-                return std::string{};
-        }
+        return std::string(MethodName(method));
     }
 
     std::string HttpUtility::To_String(HttpStatusCode code) {
@@ -87,8 +56,16 @@ namespace snow {
                 return "MethodNotAllowed";
             case HttpStatusCode::RequestTimeout:
                 return "RequestTimeout";
+            case HttpStatusCode::LengthRequired:
+                return "LengthRequired";
+            case HttpStatusCode::RangeNotSatisfiable:
+                return "RangeNotSatisfiable";
+            case HttpStatusCode::ExpectationFailed:
+                return "ExpectationFailed";
             case HttpStatusCode::ImATeapot:
                 return "ImATeapot";
+            case HttpStatusCode::TooManyRequests:
+                return "TooManyRequests";
             case HttpStatusCode::InternalServerError:
                 return "InternalServerError";
             case HttpStatusCode::NotImplemented:
@@ -108,44 +85,17 @@ namespace snow {
     }
 
     HttpMethod HttpUtility::string_to_method(std::string method) {
-        std::string method_uppercase;
-        std::transform(method.begin(), method.end(), std::back_inserter(method_uppercase),
-                       [](char c) { return toupper(c); });
-
-        if (method_uppercase == "GET")
-            return HttpMethod::GET;
-        else if (method_uppercase == "HEAD")
-            return HttpMethod::HEAD;
-        else if (method_uppercase == "POST")
-            return HttpMethod::POST;
-        else if (method_uppercase == "PUT")
-            return HttpMethod::PUT;
-        else if (method_uppercase == "DELETE")
-            return HttpMethod::DELETE;
-        else if (method_uppercase == "CONNECT")
-            return HttpMethod::CONNECT;
-        else if (method_uppercase == "OPTIONS")
-            return HttpMethod::OPTIONS;
-        else if (method_uppercase == "TRACE")
-            return HttpMethod::TRACE;
-        else if (method_uppercase == "PATCH")
-            return HttpMethod::PATCH;
-        else throw std::invalid_argument("Invalid HTTP method");
+        if (std::optional<HttpMethod> result = LookupMethod(method)) {
+            return *result;
+        }
+        throw std::invalid_argument("Invalid HTTP method");
     }
 
     HttpVersion HttpUtility::string_to_version(std::string version) {
-        std::string version_uppercase;
-        std::transform(version.begin(), version.end(), std::back_inserter(version_uppercase),
-                       [](char c) { return toupper(c); });
-        if (version_uppercase == "HTTP/0.9")
-            return HttpVersion::HTTP_0_9;
-        else if (version_uppercase == "HTTP/1.0")
-            return HttpVersion::HTTP_1_0;
-        else if (version_uppercase == "HTTP/1.1")
-            return HttpVersion::HTTP_1_1;
-        else if (version_uppercase == "HTTP/2.0")
-            return HttpVersion::HTTP_2_0;
-        else throw std::invalid_argument("Invalid HTTP version");
+        if (std::optional<HttpVersion> result = LookupVersion(version)) {
+            return *result;
+        }
+        throw std::invalid_argument("Invalid HTTP version");
     }
 
     HttpStatusCode HttpUtility::string_to_code(uint32_t code) {
@@ -190,8 +140,16 @@ namespace snow {
                 return HttpStatusCode::MethodNotAllowed;
             case 408:
                 return HttpStatusCode::RequestTimeout;
+            case 411:
+                return HttpStatusCode::LengthRequired;
+            case 416:
+                return HttpStatusCode::RangeNotSatisfiable;
+            case 417:
+                return HttpStatusCode::ExpectationFailed;
             case 418:
                 return HttpStatusCode::ImATeapot;
+            case 429:
+                return HttpStatusCode::TooManyRequests;
             case 500:
                 return HttpStatusCode::InternalServerError;
             case 501:
@@ -209,14 +167,101 @@ namespace snow {
         }
     }
 
+    namespace {
+        //返回行结束符之后下一行的起始位置，兼容"\r\n"和单独的"\n"
+        size_t NextLine(std::string_view message, size_t line_end) {
+            if (message[line_end] == '\r' && line_end + 1 < message.size() && message[line_end + 1] == '\n') {
+                return line_end + 2;
+            }
+            return line_end + 1;
+        }
+
+        //删除头尾的OWS（空格和HTAB，RFC 7230 3.2.3）
+        std::string_view TrimOws(std::string_view s) {
+            while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+            while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+            return s;
+        }
+
+        //从pos开始逐行解析header直到空行，返回body的起始位置
+        //每行只扫描一遍：行尾、冒号、非法字节和header名中的非tchar字节都在同一趟中找到
+        size_t ParseHeaderLines(std::string_view message, size_t pos, HttpMessageInterface *msg) {
+            while (pos < message.size()) {
+                LineScan line = HttpScanner::ScanLine(message.data() + pos, message.size() - pos);
+                if (line.line_end == LineScan::npos) {
+                    //没有以空行结束的header不完整，和之前一样忽略
+                    return message.size();
+                }
+                size_t next = NextLine(message, pos + line.line_end);
+                if (line.line_end == 0) {
+                    return next;
+                }
+                if (line.ctl != LineScan::npos) {
+                    throw std::invalid_argument("Invalid character in header");
+                }
+                //header名必须是非空的token，并且和冒号之间不能有空白
+                if (line.colon == LineScan::npos || line.colon == 0 || line.non_token < line.colon) {
+                    throw std::invalid_argument("Invalid header line");
+                }
+                std::string_view key = message.substr(pos, line.colon);
+                //常用header统一成标准写法，之后按名字查找时不受客户端大小写的影响
+                if (std::optional<HttpHeader> header = LookupHeader(key)) {
+                    key = HeaderName(*header);
+                }
+                std::string_view value = TrimOws(message.substr(pos + line.colon + 1, line.line_end - line.colon - 1));
+                msg->setHeader(key, value);
+                pos = next;
+            }
+            return message.size();
+        }
+
+        //请求行拆分后的各部分，指向原始报文
+        struct RequestLine {
+            std::string_view method;
+            std::string_view target;
+            std::string_view version;
+            size_t line_end = 0;
+        };
+
+        //拆分请求行: method SP request-target SP HTTP-version
+        //扫描时同时检查非法字节，成功返回nullptr，失败返回错误描述
+        const char *SplitRequestLine(std::string_view message, RequestLine *out) {
+            LineScan line = HttpScanner::ScanLine(message);
+            if (line.line_end == LineScan::npos) {
+                return "Could not find the rquest start line";
+            }
+            if (line.ctl != LineScan::npos) {
+                return "Invalid character in start line";
+            }
+            //method是token，扫描得到的第一个非tchar字节必须是分隔的空格
+            size_t method_end = line.non_token;
+            if (method_end == 0 || method_end >= line.line_end || message[method_end] != ' ') {
+                return "Invalid start line format";
+            }
+            size_t target_end = message.substr(0, line.line_end).find(' ', method_end + 1);
+            if (target_end == std::string_view::npos) {
+                return "Invalid start line format";
+            }
+            out->method = message.substr(0, method_end);
+            out->target = message.substr(method_end + 1, target_end - method_end - 1);
+            out->version = message.substr(target_end + 1, line.line_end - target_end - 1);
+            out->line_end = line.line_end;
+            return nullptr;
+        }
+
+    } // namespace
+
     //使用场景：客户端发送HttpRequest给服务器时，需要转换为string发送
     //服务器接收到string后需要转换为HttpRequest进行处理
     std::string HttpRequestToString(HttpRequest &request) {
         std::ostringstream request_stream;
         //请求行
-        request_stream << snow::HttpUtility::To_String(request.getMethod()) << " ";
-        request_stream << request.getUri().getPath() << " ";
-        request_stream << snow::HttpUtility::To_String(request.getVersion()) << "\r\n";
+        request_stream << MethodName(request.getMethod()) << " ";
+        request_stream << request.getUri().getPath();
+        if (!request.getUri().getQuery().empty())
+            request_stream << "?" << request.getUri().getQuery();
+        request_stream << " ";
+        request_stream << VersionName(request.getVersion()) << "\r\n";
         //请求头
         for (const auto &header: request.headers_) {
             request_stream << header.first << ": " << header.second << "\r\n";
@@ -229,147 +274,142 @@ namespace snow {
         return request_stream.str();
     }
 
-    HttpRequest StringToHttpRequest(const std::string &request_string) {
-        HttpRequest req;
-        std::istringstream iss;//用于解析
-        std::string start_line, headers_line, message_body;
-        std::string method, path, version;
-        std::string key, value;
-        size_t lpos = 0, rpos = 0;
-
+    HttpRequest StringToHttpRequest(std::string_view request_string, HttpRequest::allocator_type alloc) {
+        HttpRequest req(alloc);
+        std::string_view message(request_string);
 
-        //获取请求行
-        rpos = request_string.find("\r\n", lpos);
-        if (rpos == std::string::npos) {
-            throw std::invalid_argument("Could not find the rquest start line");
+        //获取并拆分请求行
+        RequestLine start_line;
+        if (const char *error = SplitRequestLine(message, &start_line)) {
+            throw std::invalid_argument(error);
         }
+        std::string_view method = start_line.method;
+        std::string_view path = start_line.target;
+        std::string_view version = start_line.version;
 
-        start_line = request_string.substr(lpos, rpos - lpos);
-        //获取完请求行之后移动左指针
-        lpos = rpos + 2;
-        //获取headers
-        rpos = request_string.find("\r\n\r\n", lpos);//找到headers结束位置
-        if (rpos != std::string::npos) {
-            headers_line = request_string.substr(lpos, rpos - lpos);
-            lpos = rpos + 4;
-            rpos = request_string.length();
-            //解析body
-            if (lpos < rpos) {
-                message_body = request_string.substr(lpos, rpos - lpos);
+        std::optional<HttpMethod> parsed_method = LookupMethod(method);
+        if (!parsed_method) {
+            throw std::invalid_argument("Invalid HTTP method");
+        }
+        req.setMethod(*parsed_method);
+        //request-target直接按视图解析，path做RFC 3986规范化，query保持原样，用到时再解码
+        UriView target;
+        if (!ParseRequestTarget(path, &target)) {
+            throw std::invalid_argument("Invalid request target");
+        }
+        Uri uri(target, alloc);
+        //绝大多数path既没有percent编码也没有点段，可以跳过规范化的临时字符串
+        if (UriNormalizer::NeedsNormalization(target.path)) {
+            std::string normalized_path;
+            if (!UriNormalizer::NormalizePath(target.path, &normalized_path)) {
+                throw std::invalid_argument("Invalid request target");
             }
+            uri.setPath(normalized_path);
         }
-
-        //解析请求行
-        iss.clear();
-        iss.str(start_line);
-        iss >> method >> path >> version;
-        if (iss.fail()) {
-            throw std::invalid_argument("Invalid start line format");
+        req.setUri(std::move(uri));
+        std::optional<HttpVersion> parsed_version = LookupVersion(version);
+        if (!parsed_version) {
+            throw std::invalid_argument("Invalid HTTP version");
         }
-        req.setMethod(HttpUtility::string_to_method(method));
-        Uri uri;
-        uri.setPath(path);
-        req.setUri(uri);
-        if (HttpUtility::string_to_version(version) != req.getVersion()) {
+        if (*parsed_version != req.getVersion()) {
             throw std::logic_error("HTTP version not supported");//目前只支持HTTP1.1
         }
 
-        //解析请求头
-        iss.clear();
-        std::string line;
-        iss.str(headers_line);
-        while (std::getline(iss, line)) {
-            std::istringstream header_stream(line);
-            std::getline(header_stream, key, ':');
-            std::getline(header_stream, value);
-
-            //删除空格（注意：只删除头尾的）
-            auto trim = [](std::string &s) {
-                s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                                [](unsigned char ch) { return !std::isspace(ch); }));
-                s.erase(std::find_if(s.rbegin(), s.rend(),
-                                     [](unsigned char ch) { return !std::isspace(ch); }).base(), s.end());
-            };
-            trim(key);
-            trim(value);
-            if (!key.empty()) {
-                req.setHeader(key, value);
-            }
-        }
-
-        req.setContent(message_body);
+        //解析请求头和请求体
+        size_t body_pos = ParseHeaderLines(message, NextLine(message, start_line.line_end), &req);
+        req.setContent(message.substr(body_pos));
 
         return req;
     }
 
+    bool PeekRequestLine(std::string_view request_string, HttpMethod *method, UriView *target) {
+        RequestLine line;
+        if (SplitRequestLine(request_string, &line) != nullptr || !ParseRequestTarget(line.target, target)) {
+            return false;
+        }
+        std::optional<HttpMethod> parsed = LookupMethod(line.method);
+        if (!parsed) {
+            return false;
+        }
+        *method = *parsed;
+        return true;
+    }
+
+    std::string_view FindHeaderValue(std::string_view message, std::string_view name) {
+        LineScan line = HttpScanner::ScanLine(message);
+        if (line.line_end == LineScan::npos) {
+            return {};
+        }
+        //跳过起始行，逐行比较header名，直到空行
+        size_t pos = NextLine(message, line.line_end);
+        while (pos < message.size()) {
+            line = HttpScanner::ScanLine(message.data() + pos, message.size() - pos);
+            if (line.line_end == LineScan::npos || line.line_end == 0) {
+                break;
+            }
+            if (line.colon != LineScan::npos) {
+                if (EqualsIgnoreCase(message.substr(pos, line.colon), name)) {
+                    return TrimOws(message.substr(pos + line.colon + 1, line.line_end - line.colon - 1));
+                }
+            }
+            pos = NextLine(message, pos + line.line_end);
+        }
+        return {};
+    }
+
     //使用场景：服务器发送HttpResponse给客户端时，需要转换为string发送
     //客户端接收到string后需要转换为HttpResponse进行处理
     std::string HttpResponseToString(HttpResponse &response, bool send_content) {
-        std::ostringstream response_stream;
-
         // 如果要发送 body，保证 Content-Length 存在
-        if (send_content && !response.getContent().empty()) {
+        if (send_content && !response.content_.empty()) {
             response.setContentLength();  // 更新 headers map
         }
 
-        // 写状态行
-        response_stream << HttpUtility::To_String(response.getVersion()) << " "
-                        << static_cast<int>(response.getStatusCode()) << " "
-                        << HttpUtility::To_String(response.getStatusCode()) << "\r\n";
+        //先算出长度，整个响应只分配一次，body也只拷贝这一次
+        std::string reason = HttpUtility::To_String(response.getStatusCode());
+        std::string code = std::to_string(static_cast<int>(response.getStatusCode()));
+        std::string_view version = VersionName(response.getVersion());
+        size_t length = version.size() + code.size() + reason.size() + 6;
+        for (const auto &header: response.headers_) {
+            length += header.first.size() + header.second.size() + 4;
+        }
+        if (send_content) {
+            length += response.content_.size();
+        }
 
+        std::string out;
+        out.reserve(length);
+        // 写状态行
+        out.append(version).append(" ").append(code).append(" ").append(reason).append("\r\n");
         // 写 headers
-        for (const auto &header: response.getHeaders()) {
-            response_stream << header.first << ": " << header.second << "\r\n";
+        for (const auto &header: response.headers_) {
+            out.append(header.first).append(": ").append(header.second).append("\r\n");
         }
-        response_stream << "\r\n";
-
+        out.append("\r\n");
         // 写 body
-        if (send_content && !response.getContent().empty()) {
-            response_stream << response.getContent();
+        if (send_content) {
+            out.append(response.content_);
         }
-
-        return response_stream.str();
+        return out;
     }
 
-    HttpResponse StringToHttpResponse(const std::string &response_string) {
+    HttpResponse StringToHttpResponse(std::string_view response_string) {
         HttpResponse rep;
         std::istringstream iss;
-        std::string status_line, headers_line, message_body;
+        std::string_view message(response_string);
         std::string version, status_code, reason_phrase;
-        std::string key, value;
-        size_t lpos = 0, rpos = 0;
-
-
-        //删除空格的辅助函数（注意：只删除头尾的）
-        auto trim = [](std::string &s) {
-            s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                            [](unsigned char ch) { return !std::isspace(ch); }));
-            s.erase(std::find_if(s.rbegin(), s.rend(),
-                                 [](unsigned char ch) { return !std::isspace(ch); }).base(), s.end());
-        };
 
         //获取状态行(status line)
-        rpos = response_string.find("\r\n", lpos);
-        if (rpos == std::string::npos) {
+        LineScan status_line = HttpScanner::ScanLine(message);
+        if (status_line.line_end == LineScan::npos) {
             throw std::invalid_argument("Could not find the status line");
         }
-        status_line = response_string.substr(lpos, rpos - lpos);
-        lpos = rpos + 2;
-        //获取响应头
-        rpos = response_string.find("\r\n\r\n", lpos);
-        if (rpos != std::string::npos) {
-            headers_line = response_string.substr(lpos, rpos - lpos);
-            lpos = rpos + 4;
-            rpos = response_string.length();
-            //获取body
-            if (lpos < rpos) {
-                message_body = response_string.substr(lpos, rpos - lpos);
-            }
+        if (status_line.ctl != LineScan::npos) {
+            throw std::invalid_argument("Invalid character in status line");
         }
 
         //解析状态行
-        iss.clear();
-        iss.str(status_line);
+        iss.str(std::string(message.substr(0, status_line.line_end)));
         iss >> version >> status_code;
         std::getline(iss, reason_phrase);   //状态原因可能包含空格，要使用getline
 
@@ -384,31 +424,10 @@ namespace snow {
         }
         rep.setStatusCode(HttpUtility::string_to_code(stoi(status_code)));
 
-        //解析请求头
-        iss.clear();
-        std::string line;
-        iss.str(headers_line);
-        while (std::getline(iss, line)) {
-            std::istringstream header_stream(line);
-            std::getline(header_stream, key, ':');
-            std::getline(header_stream, value);
-
-            //删除空格（注意：只删除头尾的）
-            auto trim = [](std::string &s) {
-                s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                                [](unsigned char ch) { return !std::isspace(ch); }));
-                s.erase(std::find_if(s.rbegin(), s.rend(),
-                                     [](unsigned char ch) { return !std::isspace(ch); }).base(), s.end());
-            };
-            trim(key);
-            trim(value);
-            if (!key.empty()) {
-                rep.setHeader(key, value);
-            }
-        }
-
-        rep.setContent(message_body);
+        //解析响应头和body
+        size_t body_pos = ParseHeaderLines(message, NextLine(message, status_line.line_end), &rep);
+        rep.setContent(message.substr(body_pos));
         return rep;
     }
 
-}
\ No newline at end of file
+}
@@ -2,7 +2,9 @@
 #define HTTP_MESSAGE_H
 
 #include <map>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include "Uri.h"
 #include <cstdint>
 #include <algorithm>
@@ -50,7 +52,11 @@ namespace snow {
         NotFound = 404,
         MethodNotAllowed = 405,
         RequestTimeout = 408,
+        LengthRequired = 411,
+        RangeNotSatisfiable = 416,
+        ExpectationFailed = 417,
         ImATeapot = 418,
+        TooManyRequests = 429,
         InternalServerError = 500,
         NotImplemented = 501,
         BadGateway = 502,
@@ -75,45 +81,81 @@ namespace snow {
         static HttpStatusCode string_to_code(uint32_t code);
     };
 
+    //header使用透明比较，可以直接用string_view查找而不用构造临时字符串
+    using HeaderMap = std::pmr::map<std::pmr::string, std::pmr::string, std::less<>>;
+
     //HttpRequest和HttpResponse的公共基类，包含两者都有的成员
+    //所有成员都从同一个memory_resource分配，传入RequestArena的分配器后整条消息的内存随arena一起释放
     class HttpMessageInterface {
     public:
-        HttpMessageInterface() : version_(HttpVersion::HTTP_1_1) {}
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+        HttpMessageInterface() : HttpMessageInterface(allocator_type{}) {}
+
+        explicit HttpMessageInterface(allocator_type alloc)
+                : version_(HttpVersion::HTTP_1_1), headers_(alloc), content_(alloc) {}
 
         virtual ~HttpMessageInterface() = default;
 
+        allocator_type get_allocator() const {
+            return headers_.get_allocator();
+        }
+
         //header methods
-        void setHeader(const std::string &key, const std::string &value) {
-            headers_[key] = std::move(value);
+        void setHeader(std::string_view key, std::string_view value) {
+            auto it = headers_.find(key);
+            if (it != headers_.end()) {
+                it->second.assign(value);
+            } else {
+                headers_.emplace(key, value);
+            }
         }
 
-        void removeHeader(const std::string &key) {
-            headers_.erase(key);
+        void removeHeader(std::string_view key) {
+            auto it = headers_.find(key);
+            if (it != headers_.end()) headers_.erase(it);
         }
 
         void clearHeaders() {
             headers_.clear();
         }
 
-        std::string getHeadersValue(const std::string &key) {
-            if (headers_.count(key) > 0) return headers_.at(key);
-            return std::string{};
+        //返回的视图指向消息内部，修改这个header或者消息析构之后失效
+        std::string_view getHeadersValue(std::string_view key) const {
+            auto it = headers_.find(key);
+            if (it != headers_.end()) return it->second;
+            return {};
         }
 
-        std::map <std::string, std::string> getHeaders() const {
+        const HeaderMap &getHeaders() const {
             return headers_;
         }
 
         //Content functions
-        std::string getContent() const {
+        //和getHeadersValue一样，视图在修改content之前有效
+        std::string_view getContent() const {
             return content_;
         }
 
-        void setContent(const std::string &content) {
+        void setContent(std::string_view content) {
+            content_.assign(content);
+            setContentLength();
+        }
+
+        //接管content的内存而不拷贝；content的分配器和消息不同时(例如消息在RequestArena里)仍然会拷贝
+        void adoptContent(std::pmr::string &&content) {
             content_ = std::move(content);
             setContentLength();
         }
 
+        //取走消息体，消息的content变为空
+        std::pmr::string releaseContent() {
+            std::pmr::string content = std::move(content_);
+            content_.clear();
+            setContentLength();
+            return content;
+        }
+
         void clearContent() {
             content_.clear();
             setContentLength();
@@ -134,8 +176,8 @@ namespace snow {
 
     protected:
         HttpVersion version_;                       //http版本号
-        std::map <std::string, std::string> headers_;//头部
-        std::string content_;                       //消息体
+        HeaderMap headers_;                         //头部
+        std::pmr::string content_;                  //消息体
 
         //如果需要发送content，就需要设置content length
         void setContentLength() {
@@ -145,7 +187,10 @@ namespace snow {
 
     class HttpRequest : public HttpMessageInterface {
     public:
-        HttpRequest() : method_(HttpMethod::GET) {}
+        HttpRequest() : HttpRequest(allocator_type{}) {}
+
+        explicit HttpRequest(allocator_type alloc)
+                : HttpMessageInterface(alloc), method_(HttpMethod::GET), uri_(alloc) {}
 
         ~HttpRequest() = default;
 
@@ -163,14 +208,14 @@ namespace snow {
             return method_;
         }
 
-        Uri getUri() const {
+        const Uri &getUri() const {
             return uri_;
         }
 
         //友元函数
         friend std::string HttpRequestToString(HttpRequest &request);
 
-        friend HttpRequest StringToHttpRequest(const std::string &request_string);
+        friend HttpRequest StringToHttpRequest(std::string_view request_string, HttpRequest::allocator_type alloc);
 
     private:
         HttpMethod method_;
@@ -179,7 +224,10 @@ namespace snow {
 
     class HttpResponse : public HttpMessageInterface {
     public:
-        HttpResponse() : status_code_(HttpStatusCode::Ok) {}
+        HttpResponse() : HttpResponse(allocator_type{}) {}
+
+        explicit HttpResponse(allocator_type alloc)
+                : HttpMessageInterface(alloc), status_code_(HttpStatusCode::Ok) {}
 
         ~HttpResponse() = default;
 
@@ -195,7 +243,7 @@ namespace snow {
 
         //友元函数
         friend std::string HttpResponseToString(HttpResponse &response, bool sent_content);//友元函数声明里面不能写默认参数
-        friend HttpResponse StringToHttpResponse(const std::string &response_string);
+        friend HttpResponse StringToHttpResponse(std::string_view response_string);
 
     private:
         HttpStatusCode status_code_;
@@ -206,7 +254,16 @@ namespace snow {
     //实现客户端和服务端之间收发消息的工具函数
     std::string HttpRequestToString(HttpRequest &request);
     std::string HttpResponseToString(HttpResponse &response, bool sent_content = true);//HttpResponse可以选择性发送内容返回
-    HttpRequest StringToHttpRequest(const std::string &request_string);
-    HttpResponse StringToHttpResponse(const std::string &response_string);
+    //alloc用于请求的所有内存分配，服务端传入RequestArena的分配器
+    HttpRequest StringToHttpRequest(std::string_view request_string, HttpRequest::allocator_type alloc = {});
+    HttpResponse StringToHttpResponse(std::string_view response_string);
+
+    //只拆分请求行而不解析header，用于在完整解析之前决定请求交给哪个线程处理
+    //target中的path尚未规范化，格式错误时返回false
+    bool PeekRequestLine(std::string_view request_string, HttpMethod *method, UriView *target);
+
+    //在原始报文的header部分中按名字(不区分大小写)查找header，返回去掉OWS的值，找不到时返回空
+    //用于在完整解析之前读取Content-Length、Transfer-Encoding这类决定报文边界的header
+    std::string_view FindHeaderValue(std::string_view message, std::string_view name);
 }
 #endif // HTTP_MESSAGE_H
\ No newline at end of file
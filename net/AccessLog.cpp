@@ -0,0 +1,363 @@
+#include "AccessLog.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+namespace snow {
+    namespace {
+        // Layout shared by the rings and kBinary files. A record is this header
+        // followed by the request text, padded to a multiple of 8 bytes.
+        struct RecordHeader {
+            std::uint32_t size;             //整条记录的字节数，包括填充
+            std::uint16_t status;
+            std::uint16_t request_length;
+            std::uint8_t peer_addr[16];
+            std::uint64_t time_ns;
+            std::uint64_t duration_ns;
+            std::uint64_t bytes_sent;
+        };
+        static_assert(sizeof(RecordHeader) == 48, "the binary format depends on this layout");
+
+        //环形缓冲区末尾放不下一条记录时写入的填充，只有size和status有效，不会写入文件
+        constexpr std::uint16_t kPaddingStatus = 0xffff;
+        constexpr char kBinaryMagic[8] = {'S', 'N', 'O', 'W', 'L', 'O', 'G', '2'};
+        constexpr size_t kMinRingBytes = 64 * 1024;
+
+        std::atomic<std::uint64_t> next_log_id{1};
+
+        size_t RecordSize(size_t request_length) {
+            return (sizeof(RecordHeader) + request_length + 7) & ~size_t{7};
+        }
+
+        // One text line per record:
+        // 2026-10-19T08:15:30.123Z 10.0.0.1 "GET /index.html" 200 1234 0.532ms
+        void AppendText(std::string *out, const RecordHeader &header, std::string_view request) {
+            char buffer[160];
+            time_t seconds = static_cast<time_t>(header.time_ns / 1000000000);
+            tm parts;
+            gmtime_r(&seconds, &parts);
+            size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &parts);
+            length += static_cast<size_t>(snprintf(buffer + length, sizeof(buffer) - length, ".%03uZ ",
+                                                   static_cast<unsigned>(header.time_ns / 1000000 % 1000)));
+            in6_addr addr;
+            memcpy(&addr, header.peer_addr, sizeof(addr));
+            if (IN6_IS_ADDR_UNSPECIFIED(&addr)) {
+                buffer[length++] = '-';
+            } else {
+                //IPv4客户端按点分十进制输出，而不是::ffff:的形式
+                bool v4 = IN6_IS_ADDR_V4MAPPED(&addr);
+                inet_ntop(v4 ? AF_INET : AF_INET6, v4 ? &addr.s6_addr[12] : addr.s6_addr, buffer + length,
+                          static_cast<socklen_t>(sizeof(buffer) - length));
+                length += strlen(buffer + length);
+            }
+            out->append(buffer, length);
+
+            out->append(" \"");
+            if (request.empty()) out->push_back('-');
+            //请求行来自客户端，控制字符和引号转义之后一行日志仍然是一行
+            for (char c : request) {
+                auto byte = static_cast<unsigned char>(c);
+                if (byte < 0x20 || byte >= 0x7f || c == '"' || c == '\\') {
+                    snprintf(buffer, sizeof(buffer), "\\x%02x", byte);
+                    out->append(buffer, 4);
+                } else {
+                    out->push_back(c);
+                }
+            }
+            snprintf(buffer, sizeof(buffer), "\" %u %llu %.3fms\n", header.status,
+                     static_cast<unsigned long long>(header.bytes_sent),
+                     static_cast<double>(header.duration_ns) / 1e6);
+            out->append(buffer);
+        }
+    } // namespace
+
+    // Single-producer single-consumer byte ring. Positions only grow; the offset in
+    // data is the position modulo capacity, which is a power of two.
+    struct AccessLog::Ring {
+        explicit Ring(size_t bytes) : data(new char[bytes]), capacity(bytes) {}
+
+        std::unique_ptr<char[]> data;
+        const size_t capacity;
+        alignas(64) std::atomic<std::uint64_t> head{0};    //由记录日志的线程推进
+        alignas(64) std::atomic<std::uint64_t> tail{0};    //由后台线程推进
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    AccessLog::AccessLog(AccessLogConfig config)
+            : config_(std::move(config)),
+              id_(next_log_id.fetch_add(1, std::memory_order_relaxed)),
+              ring_capacity_(kMinRingBytes) {
+        while (ring_capacity_ < config_.buffer_bytes) {
+            ring_capacity_ <<= 1;
+        }
+    }
+
+    AccessLog::~AccessLog() {
+        Stop();
+    }
+
+    bool AccessLog::Start() {
+        if (!OpenFile()) {
+            return false;
+        }
+        running_ = true;
+        writer_ = std::thread(&AccessLog::WriterLoop, this);
+        return true;
+    }
+
+    void AccessLog::Stop() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            running_ = false;
+        }
+        wake_.notify_one();
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        if (fd_ != -1) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void AccessLog::Reopen() {
+        reopen_.store(true, std::memory_order_relaxed);
+    }
+
+    std::uint64_t AccessLog::dropped() const {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        std::uint64_t total = 0;
+        for (const auto &entry : rings_) {
+            total += entry.second->dropped.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    AccessLog::Ring *AccessLog::ThisThreadRing() {
+        // A thread logs to one server's log almost always, so a single cached entry
+        // keeps the lookup off the mutex after the first record.
+        thread_local std::uint64_t cached_id = 0;
+        thread_local Ring *cached_ring = nullptr;
+        if (cached_id == id_) {
+            return cached_ring;
+        }
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        std::unique_ptr<Ring> &ring = rings_[std::this_thread::get_id()];
+        if (!ring) {
+            ring = std::make_unique<Ring>(ring_capacity_);
+        }
+        cached_id = id_;
+        cached_ring = ring.get();
+        return cached_ring;
+    }
+
+    void AccessLog::Log(const AccessEntry &entry) {
+        Ring *ring = ThisThreadRing();
+        std::string_view request = entry.request.substr(0, kMaxRequestLength);
+        size_t size = RecordSize(request.size());
+
+        std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+        std::uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        size_t offset = head & (ring->capacity - 1);
+        size_t to_end = ring->capacity - offset;
+        //记录不跨越缓冲区末尾，这样后台线程可以直接把它交给writev
+        size_t padding = to_end < size ? to_end : 0;
+        if (head + padding + size - tail > ring->capacity) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        char *data = ring->data.get();
+        if (padding) {
+            auto padding_size = static_cast<std::uint32_t>(padding);
+            memcpy(data + offset, &padding_size, sizeof(padding_size));
+            memcpy(data + offset + offsetof(RecordHeader, status), &kPaddingStatus, sizeof(kPaddingStatus));
+            offset = 0;
+        }
+        RecordHeader header{};
+        header.size = static_cast<std::uint32_t>(size);
+        header.status = entry.status;
+        header.request_length = static_cast<std::uint16_t>(request.size());
+        memcpy(header.peer_addr, entry.peer_addr.data(), sizeof(header.peer_addr));
+        header.time_ns = entry.time_ns;
+        header.duration_ns = entry.duration_ns;
+        header.bytes_sent = entry.bytes_sent;
+        memcpy(data + offset, &header, sizeof(header));
+        memcpy(data + offset + sizeof(header), request.data(), request.size());
+        ring->head.store(head + padding + size, std::memory_order_release);
+    }
+
+    void AccessLog::WriterLoop() {
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        while (running_) {
+            wake_.wait_for(lock, config_.flush_interval);
+            lock.unlock();
+            Flush();
+            lock.lock();
+        }
+        lock.unlock();
+        //Stop()之前记录的日志也要写出去
+        Flush();
+    }
+
+    void AccessLog::Flush() {
+        struct Drained {
+            Ring *ring;
+            std::uint64_t head;
+        };
+        std::vector<Drained> drained;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            drained.reserve(rings_.size());
+            for (const auto &entry : rings_) {
+                drained.push_back(Drained{entry.second.get(), entry.second->head.load(std::memory_order_acquire)});
+            }
+        }
+
+        bool binary = config_.format == AccessLogFormat::kBinary;
+        std::vector<iovec> iov;
+        std::string text;
+        size_t bytes = 0;
+        for (const Drained &ring : drained) {
+            const char *data = ring.ring->data.get();
+            std::uint64_t position = ring.ring->tail.load(std::memory_order_relaxed);
+            while (position < ring.head) {
+                size_t offset = position & (ring.ring->capacity - 1);
+                RecordHeader header;
+                memcpy(&header, data + offset, offsetof(RecordHeader, request_length));
+                if (header.status != kPaddingStatus) {
+                    if (binary) {
+                        // Records written back to back in the ring stay one iovec
+                        if (!iov.empty() && static_cast<char *>(iov.back().iov_base) + iov.back().iov_len ==
+                                            data + offset) {
+                            iov.back().iov_len += header.size;
+                        } else {
+                            iov.push_back(iovec{const_cast<char *>(data + offset), header.size});
+                        }
+                        bytes += header.size;
+                    } else {
+                        memcpy(&header, data + offset, sizeof(header));
+                        AppendText(&text, header,
+                                   std::string_view(data + offset + sizeof(header), header.request_length));
+                    }
+                }
+                position += header.size;
+            }
+        }
+
+        std::uint64_t drops = dropped();
+        if (!binary && drops > reported_drops_) {
+            text += "# dropped " + std::to_string(drops - reported_drops_) + " records\n";
+        }
+        reported_drops_ = drops;
+        if (!binary && !text.empty()) {
+            iov.push_back(iovec{text.data(), text.size()});
+            bytes = text.size();
+        }
+
+        if (reopen_.exchange(false, std::memory_order_relaxed)) {
+            if (fd_ != -1) close(fd_);
+            OpenFile();
+        }
+        if (bytes > 0) {
+            if (config_.max_file_bytes > 0 && file_bytes_ > 0 && file_bytes_ + bytes > config_.max_file_bytes) {
+                Rotate();
+            }
+            WriteBatch(iov.data(), static_cast<int>(iov.size()), bytes);
+        }
+
+        //写入失败的记录同样被丢弃，不能让缓冲区一直满着
+        for (const Drained &ring : drained) {
+            ring.ring->tail.store(ring.head, std::memory_order_release);
+        }
+    }
+
+    bool AccessLog::OpenFile() {
+        fd_ = open(config_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+            return false;
+        }
+        struct stat info;
+        file_bytes_ = fstat(fd_, &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+        if (config_.format == AccessLogFormat::kBinary && file_bytes_ == 0) {
+            iovec magic{const_cast<char *>(kBinaryMagic), sizeof(kBinaryMagic)};
+            return WriteBatch(&magic, 1, sizeof(kBinaryMagic));
+        }
+        return true;
+    }
+
+    void AccessLog::Rotate() {
+        close(fd_);
+        int keep = std::max(config_.max_files, 1);
+        for (int i = keep - 1; i >= 1; --i) {
+            std::string from = config_.path + "." + std::to_string(i);
+            std::string to = config_.path + "." + std::to_string(i + 1);
+            rename(from.c_str(), to.c_str());
+        }
+        rename(config_.path.c_str(), (config_.path + ".1").c_str());
+        OpenFile();
+    }
+
+    bool AccessLog::WriteBatch(iovec *iov, int count, size_t bytes) {
+        if (fd_ == -1) {
+            return false;
+        }
+        file_bytes_ += bytes;
+        while (count > 0) {
+            ssize_t written = writev(fd_, iov, std::min(count, IOV_MAX));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            auto remaining = static_cast<size_t>(written);
+            while (count > 0 && remaining >= iov->iov_len) {
+                remaining -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + remaining;
+                iov->iov_len -= remaining;
+            }
+        }
+        return true;
+    }
+
+    bool AccessLog::RenderBinary(std::istream &binary, std::ostream &text) {
+        char magic[sizeof(kBinaryMagic)];
+        if (!binary.read(magic, sizeof(magic)) || memcmp(magic, kBinaryMagic, sizeof(magic)) != 0) {
+            return false;
+        }
+        std::vector<char> record;
+        std::string line;
+        while (true) {
+            RecordHeader header;
+            binary.read(reinterpret_cast<char *>(&header), sizeof(header));
+            if (binary.gcount() == 0) {
+                return true;
+            }
+            if (binary.gcount() != sizeof(header) || header.size < sizeof(header) ||
+                RecordSize(header.request_length) != header.size) {
+                return false;
+            }
+            record.resize(header.size - sizeof(header));
+            if (!binary.read(record.data(), static_cast<std::streamsize>(record.size()))) {
+                return false;
+            }
+            line.clear();
+            AppendText(&line, header, std::string_view(record.data(), header.request_length));
+            text << line;
+        }
+    }
+
+} // snow
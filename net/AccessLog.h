@@ -0,0 +1,122 @@
+#ifndef SNOW_HTTP_SERVER_ACCESSLOG_H
+#define SNOW_HTTP_SERVER_ACCESSLOG_H
+
+#include <sys/uio.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace snow {
+
+    enum class AccessLogFormat {
+        kText,      //每个请求一行文本，由后台线程格式化
+        kBinary     //定长记录直接写入文件，用AccessLog::RenderBinary离线转换成文本
+    };
+
+    struct AccessLogConfig {
+        std::string path;
+        AccessLogFormat format = AccessLogFormat::kText;
+        //每个记录日志的线程的缓冲区大小，满了之后的记录被丢弃并计数
+        size_t buffer_bytes = 1 << 20;
+        //文件超过这个大小时轮转为path.1、path.2...，0表示不轮转
+        size_t max_file_bytes = 256 << 20;
+        int max_files = 5;
+        //后台线程把缓冲区写入文件的间隔
+        std::chrono::milliseconds flush_interval{100};
+    };
+
+    //一个请求的日志内容
+    struct AccessEntry {
+        std::uint64_t time_ns = 0;          //请求结束的时间，CLOCK_REALTIME
+        std::uint64_t duration_ns = 0;      //从accept到请求结束
+        std::uint64_t bytes_sent = 0;
+        std::array<std::uint8_t, 16> peer_addr{};   //IPv6地址，IPv4存成::ffff:a.b.c.d，全0表示未知
+        std::uint16_t status = 0;           //0表示没有发出响应
+        std::string_view request;           //"METHOD target"，超过kMaxRequestLength的部分被截断
+    };
+
+    // Access log that never blocks the thread that logs.
+    //
+    // Log() copies a compact binary record into a ring buffer owned by the calling
+    // thread; the only shared state it touches is that ring's two positions, so it
+    // takes no lock and makes no system call. A background thread drains every ring
+    // each flush_interval and hands the batch to the kernel with one writev. When a
+    // ring is full the record is dropped and counted instead of waiting for the
+    // writer; the text log reports drops as they happen.
+    class AccessLog {
+    public:
+        static constexpr size_t kMaxRequestLength = 1024;
+
+        explicit AccessLog(AccessLogConfig config);
+
+        ~AccessLog();
+
+        AccessLog(const AccessLog &) = delete;
+
+        AccessLog &operator=(const AccessLog &) = delete;
+
+        //打开文件并启动后台线程，文件打不开时返回false
+        bool Start();
+
+        //写出所有缓冲的记录后停止后台线程
+        void Stop();
+
+        //可以在任意线程调用，不会阻塞
+        void Log(const AccessEntry &entry);
+
+        //下一次写入前重新打开文件(外部工具移走文件之后调用)
+        void Reopen();
+
+        //因为缓冲区满而丢弃的记录总数
+        std::uint64_t dropped() const;
+
+        //把kBinary格式的日志转换成kText格式，格式不正确时返回false
+        static bool RenderBinary(std::istream &binary, std::ostream &text);
+
+    private:
+        struct Ring;
+
+        Ring *ThisThreadRing();
+
+        void WriterLoop();
+
+        void Flush();
+
+        bool OpenFile();
+
+        void Rotate();
+
+        bool WriteBatch(iovec *iov, int count, size_t bytes);
+
+        AccessLogConfig config_;
+        const std::uint64_t id_;       //区分不同实例的线程缓存
+        size_t ring_capacity_;
+
+        mutable std::mutex rings_mutex_;
+        std::map<std::thread::id, std::unique_ptr<Ring>> rings_;
+
+        int fd_ = -1;
+        size_t file_bytes_ = 0;
+        std::uint64_t reported_drops_ = 0;
+        std::atomic<bool> reopen_{false};
+
+        std::mutex wake_mutex_;
+        std::condition_variable wake_;
+        bool running_ = false;
+        std::thread writer_;
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_ACCESSLOG_H
@@ -0,0 +1,135 @@
+#include "AdmissionControl.h"
+
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+#include "http/http_message.h"
+
+namespace snow {
+
+    namespace {
+        //拒绝响应只在启动时序列化一次
+        std::string SerializeReject(HttpStatusCode code, const std::string &body) {
+            HttpResponse response;
+            response.setStatusCode(code);
+            response.setHeader("Content-Type", "text/plain");
+            response.setHeader("Connection", "close");
+            response.setHeader("Retry-After", "1");
+            response.setContent(body);
+            return HttpResponseToString(response);
+        }
+    } // namespace
+
+    void TokenBucketTable::Configure(double rate_per_sec, double burst, size_t max_clients_per_shard) {
+        rate_per_sec_ = rate_per_sec;
+        // A bucket must hold at least one token or no request would ever pass.
+        burst_ = std::max(burst, 1.0);
+        max_clients_per_shard_ = max_clients_per_shard;
+    }
+
+    bool TokenBucketTable::TryAcquire(std::uint64_t client_key, std::chrono::steady_clock::time_point now) {
+        Shard &shard = shards_[std::hash<std::uint64_t>{}(client_key) % kShardCount];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.buckets.find(client_key);
+        if (it == shard.buckets.end()) {
+            if (shard.buckets.size() >= max_clients_per_shard_) {
+                EvictIdle(shard, now);
+            }
+            // A new client starts with a full bucket and spends one token right away.
+            shard.buckets.emplace(client_key, Bucket{burst_ - 1, now});
+            return true;
+        }
+
+        Bucket &bucket = it->second;
+        std::chrono::duration<double> elapsed = now - bucket.last_refill;
+        bucket.tokens = std::min(burst_, bucket.tokens + elapsed.count() * rate_per_sec_);
+        bucket.last_refill = now;
+        if (bucket.tokens < 1) {
+            return false;
+        }
+        bucket.tokens -= 1;
+        return true;
+    }
+
+    void TokenBucketTable::EvictIdle(Shard &shard, std::chrono::steady_clock::time_point now) {
+        // A bucket that would have refilled completely carries no state worth keeping:
+        // dropping it is indistinguishable from keeping a full bucket.
+        std::chrono::duration<double> refill_time(burst_ / rate_per_sec_);
+        for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+            if (now - it->second.last_refill >= refill_time) {
+                it = shard.buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        // Still full of active clients: forget the oldest entry rather than grow without bound.
+        if (shard.buckets.size() >= max_clients_per_shard_) {
+            auto oldest = std::min_element(shard.buckets.begin(), shard.buckets.end(),
+                                           [](const auto &a, const auto &b) {
+                                               return a.second.last_refill < b.second.last_refill;
+                                           });
+            shard.buckets.erase(oldest);
+        }
+    }
+
+    AdmissionController::AdmissionController()
+            : too_many_requests_(SerializeReject(HttpStatusCode::TooManyRequests, "Too Many Requests")),
+              service_unavailable_(SerializeReject(HttpStatusCode::ServiceUnvailable, "Service Unavailable")) {
+        Configure(config_);
+    }
+
+    void AdmissionController::Configure(const AdmissionConfig &config) {
+        config_ = config;
+        buckets_.Configure(config.client_rate_per_sec, config.client_burst, config.max_clients_per_shard);
+    }
+
+    AdmissionVerdict AdmissionController::Admit(std::uint64_t client_key, size_t queue_depth,
+                                                std::chrono::microseconds queue_wait) {
+        // Shed on global pressure first, so an overloaded server does not also
+        // charge the client's bucket for a request it is going to refuse anyway.
+        if (config_.max_queue_depth != 0 && queue_depth >= config_.max_queue_depth) {
+            return AdmissionVerdict::kOverloaded;
+        }
+        if (config_.max_queue_wait.count() != 0 && queue_wait >= config_.max_queue_wait) {
+            return AdmissionVerdict::kOverloaded;
+        }
+        if (config_.client_rate_per_sec > 0 &&
+            !buckets_.TryAcquire(client_key, std::chrono::steady_clock::now())) {
+            return AdmissionVerdict::kRateLimited;
+        }
+        return AdmissionVerdict::kAdmit;
+    }
+
+    const std::string &AdmissionController::RejectResponse(AdmissionVerdict verdict) const {
+        return verdict == AdmissionVerdict::kRateLimited ? too_many_requests_ : service_unavailable_;
+    }
+
+    std::uint64_t AdmissionController::ClientKey(const sockaddr *addr, socklen_t addr_len) {
+        // The key hashes the address family together with the address bytes, so
+        // equal bytes from different families are different clients.
+        char key[sizeof(sa_family_t) + 8];
+        memcpy(key, &addr->sa_family, sizeof(sa_family_t));
+        size_t length = sizeof(sa_family_t);
+        if (addr->sa_family == AF_INET) {
+            const auto *in = reinterpret_cast<const sockaddr_in *>(addr);
+            memcpy(key + length, &in->sin_addr, sizeof(in->sin_addr));
+            length += sizeof(in->sin_addr);
+        } else if (addr->sa_family == AF_INET6) {
+            // Rate-limit IPv6 clients per /64, the smallest prefix a host is usually given.
+            const auto *in6 = reinterpret_cast<const sockaddr_in6 *>(addr);
+            memcpy(key + length, in6->sin6_addr.s6_addr, 8);
+            length += 8;
+        } else {
+            // Whole address, family included
+            return std::hash<std::string_view>{}(
+                    std::string_view(reinterpret_cast<const char *>(addr), addr_len));
+        }
+        return std::hash<std::string_view>{}(std::string_view(key, length));
+    }
+
+} // snow
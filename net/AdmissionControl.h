@@ -0,0 +1,95 @@
+#ifndef SNOW_HTTP_SERVER_ADMISSIONCONTROL_H
+#define SNOW_HTTP_SERVER_ADMISSIONCONTROL_H
+
+#include <sys/socket.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace snow {
+
+    //准入控制的配置，必须在HttpServer::Start()之前设置
+    struct AdmissionConfig {
+        //每个客户端的令牌桶：每秒持续的请求数和突发的大小，速率为0时不限流
+        double client_rate_per_sec = 0;
+        double client_burst = 0;
+
+        //worker队列的长度和等待时间超过这两个值时拒绝新请求，0表示不检查
+        size_t max_queue_depth = 1024;
+        std::chrono::microseconds max_queue_wait = std::chrono::milliseconds(500);
+
+        //每个分片最多记录的客户端数，超过时淘汰空闲的令牌桶
+        size_t max_clients_per_shard = 4096;
+    };
+
+    enum class AdmissionVerdict {
+        kAdmit,
+        kRateLimited,   //429, the client exceeded its token bucket
+        kOverloaded     //503, the worker queue is too deep or too slow
+    };
+
+    // Sharded table of per-client token buckets. Each shard has its own mutex so
+    // concurrent lookups for different clients rarely contend, and the critical
+    // section is a single hash lookup plus a little arithmetic.
+    class TokenBucketTable {
+    public:
+        TokenBucketTable() = default;
+
+        void Configure(double rate_per_sec, double burst, size_t max_clients_per_shard);
+
+        //尝试为client_key取走一个token，成功返回true
+        bool TryAcquire(std::uint64_t client_key, std::chrono::steady_clock::time_point now);
+
+    private:
+        static constexpr size_t kShardCount = 64;
+
+        struct Bucket {
+            double tokens;
+            std::chrono::steady_clock::time_point last_refill;
+        };
+
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::unordered_map<std::uint64_t, Bucket> buckets;
+        };
+
+        double rate_per_sec_ = 0;
+        double burst_ = 0;
+        size_t max_clients_per_shard_ = 0;
+        std::array<Shard, kShardCount> shards_;
+
+        void EvictIdle(Shard &shard, std::chrono::steady_clock::time_point now);
+    };
+
+    // Decides, before a readable connection is parsed or queued, whether the
+    // server should take on the request. Rejections are answered with one of the
+    // pre-serialized responses so the reject path never allocates.
+    class AdmissionController {
+    public:
+        AdmissionController();
+
+        void Configure(const AdmissionConfig &config);
+
+        AdmissionVerdict Admit(std::uint64_t client_key, size_t queue_depth,
+                               std::chrono::microseconds queue_wait);
+
+        //返回对应的预先序列化好的拒绝响应
+        const std::string &RejectResponse(AdmissionVerdict verdict) const;
+
+        //由对端地址生成client_key：地址族和地址一起做哈希，IPv6只取/64前缀
+        static std::uint64_t ClientKey(const sockaddr *addr, socklen_t addr_len);
+
+    private:
+        AdmissionConfig config_;
+        TokenBucketTable buckets_;
+        std::string too_many_requests_;
+        std::string service_unavailable_;
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_ADMISSIONCONTROL_H
@@ -0,0 +1,56 @@
+#include "CompletionQueue.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdint>
+
+#include "HttpServer.h"
+
+namespace snow {
+    CompletionQueue::CompletionQueue() : event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+    CompletionQueue::~CompletionQueue() {
+        if (event_fd_ != -1) {
+            close(event_fd_);
+        }
+    }
+
+    void CompletionQueue::Push(EventData *event) {
+        // Release: the loop that takes event sees everything the worker wrote to it
+        EventData *head = head_.load(std::memory_order_relaxed);
+        do {
+            event->next_completed = head;
+        } while (!head_.compare_exchange_weak(head, event, std::memory_order_release, std::memory_order_relaxed));
+        if (head == nullptr) {
+            // The loop has taken everything before this; anything pushed after it
+            // rides along on this wakeup.
+            Wake();
+        }
+    }
+
+    EventData *CompletionQueue::TakeAll() {
+        // Reset the counter before taking the batch, so a push in between either lands
+        // in this batch or finds the queue empty and writes the eventfd again.
+        std::uint64_t count;
+        ssize_t ignored = read(event_fd_, &count, sizeof(count));
+        (void) ignored;
+        EventData *stack = head_.exchange(nullptr, std::memory_order_acquire);
+        // The stack holds the newest first; reverse it so responses go out in order
+        EventData *ordered = nullptr;
+        while (stack) {
+            EventData *next = stack->next_completed;
+            stack->next_completed = ordered;
+            ordered = stack;
+            stack = next;
+        }
+        return ordered;
+    }
+
+    void CompletionQueue::Wake() {
+        std::uint64_t one = 1;
+        ssize_t ignored = write(event_fd_, &one, sizeof(one));
+        (void) ignored;
+    }
+
+} // snow
@@ -0,0 +1,50 @@
+#ifndef SNOW_HTTP_SERVER_COMPLETIONQUEUE_H
+#define SNOW_HTTP_SERVER_COMPLETIONQUEUE_H
+
+#include <atomic>
+
+namespace snow {
+
+    struct EventData;
+
+    // Hands connections whose response is ready from worker threads back to the
+    // event loop.
+    //
+    // Any number of threads Push(); only the loop takes. The queue is an intrusive
+    // lock-free stack linked through EventData::next_completed, so a push is one
+    // compare-and-swap and never allocates. Only the push that finds the queue empty
+    // writes the eventfd: a burst of completions costs the loop a single wakeup, after
+    // which TakeAll() returns all of them, oldest first, to be written in one pass.
+    class CompletionQueue {
+    public:
+        CompletionQueue();
+
+        ~CompletionQueue();
+
+        CompletionQueue(const CompletionQueue &) = delete;
+
+        CompletionQueue &operator=(const CompletionQueue &) = delete;
+
+        //eventfd创建失败时为false
+        bool valid() const { return event_fd_ != -1; }
+
+        //由事件循环监听的eventfd，可读表示有完成的连接
+        int fd() const { return event_fd_; }
+
+        //把event交给事件循环，可以在任意线程调用，之后调用方不能再访问event
+        void Push(EventData *event);
+
+        //只在事件循环线程上调用：取出所有完成的连接，按完成的顺序通过next_completed串起来
+        EventData *TakeAll();
+
+        //没有完成的连接也唤醒事件循环一次(Stop时使用)
+        void Wake();
+
+    private:
+        int event_fd_;
+        std::atomic<EventData *> head_{nullptr};
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_COMPLETIONQUEUE_H
@@ -0,0 +1,117 @@
+#include "EventChannel.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <utility>
+
+namespace snow {
+    namespace {
+        // The body of a heartbeat: an SSE comment line, which clients ignore
+        const std::shared_ptr<const std::string> &PingFrame() {
+            static const auto frame = std::make_shared<const std::string>(":\n\n");
+            return frame;
+        }
+
+        // A long-poll request that got no event; the client simply asks again.
+        const std::shared_ptr<const std::string> &PingResponse() {
+            static const auto response = std::make_shared<const std::string>(
+                    "HTTP/1.1 204 No Content\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n");
+            return response;
+        }
+
+        // Appends one "data:" field per line. "\r\n", "\r" and "\n" all end a line in an
+        // event stream, so a bare carriage return in data would otherwise split it.
+        void AppendData(std::string *frame, std::string_view data) {
+            while (true) {
+                size_t end = data.find_first_of("\r\n");
+                frame->append("data: ").append(data.substr(0, end)).append("\n");
+                if (end == std::string_view::npos) {
+                    return;
+                }
+                size_t next = end + 1;
+                if (data[end] == '\r' && next < data.size() && data[next] == '\n') {
+                    ++next;
+                }
+                data.remove_prefix(next);
+            }
+        }
+    } // namespace
+
+    EventChannel::EventChannel(EventChannelOptions options)
+            : options_(std::move(options)),
+              event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+    EventChannel::~EventChannel() {
+        if (event_fd_ != -1) {
+            close(event_fd_);
+        }
+    }
+
+    void EventChannel::Publish(std::string_view data, std::string_view event, std::string_view id) {
+        if (subscribers() == 0) {
+            return;
+        }
+        Message message;
+        auto frame = std::make_shared<std::string>();
+        frame->reserve(data.size() + event.size() + id.size() + 32);
+        if (!event.empty()) {
+            frame->append("event: ").append(event).append("\n");
+        }
+        if (!id.empty()) {
+            frame->append("id: ").append(id).append("\n");
+        }
+        AppendData(frame.get(), data);
+        frame->append("\n");
+        message.frame = std::move(frame);
+
+        if (has_long_poll_.load(std::memory_order_relaxed)) {
+            auto response = std::make_shared<std::string>();
+            ResponseWriter writer(response.get(), "Cache-Control: no-cache\r\nConnection: close\r\n");
+            writer.Header(HttpHeader::ContentType, options_.long_poll_content_type);
+            writer.Body(data);
+            message.long_poll = std::move(response);
+        }
+        message.long_poll_status = static_cast<std::uint16_t>(HttpStatusCode::Ok);
+        Post(std::move(message));
+    }
+
+    void EventChannel::Ping() {
+        if (subscribers() == 0) {
+            return;
+        }
+        Post(Message{PingFrame(), PingResponse(), static_cast<std::uint16_t>(HttpStatusCode::NoContent)});
+    }
+
+    void EventChannel::Post(Message message) {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wake = pending_.empty();
+            pending_.push_back(std::move(message));
+        }
+        // One wakeup covers everything queued until the loop takes the batch
+        if (wake) {
+            std::uint64_t one = 1;
+            ssize_t ignored = write(event_fd_, &one, sizeof(one));
+            (void) ignored;
+        }
+    }
+
+    void EventChannel::OnEvents(std::uint32_t) {
+        // Reset the counter before taking the batch, so a message posted in between
+        // either lands in this batch or writes the eventfd again.
+        std::uint64_t count;
+        ssize_t ignored = read(event_fd_, &count, sizeof(count));
+        (void) ignored;
+        std::vector<Message> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batch.swap(pending_);
+        }
+        for (const Message &message : batch) {
+            server_->Broadcast(this, message.frame, message.long_poll, message.long_poll_status);
+        }
+    }
+
+} // snow
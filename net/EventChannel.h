@@ -0,0 +1,87 @@
+#ifndef SNOW_HTTP_SERVER_EVENTCHANNEL_H
+#define SNOW_HTTP_SERVER_EVENTCHANNEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "HttpServer.h"
+
+namespace snow {
+
+    struct EventChannelOptions {
+        //一个订阅者还没写出的事件超过这个数时断开它，客户端重连后可以用Last-Event-ID补齐
+        size_t max_queued_events = 256;
+        //长轮询响应的Content-Type
+        std::string long_poll_content_type = "text/plain; charset=utf-8";
+    };
+
+    // A topic whose events are pushed to every connection subscribed to it through
+    // HttpServer::RegisterEventStream, as a Server-Sent Events stream or as the
+    // response to a long-poll request.
+    //
+    // Subscribers are parked on the event loop: no thread waits for them, and each one
+    // only holds the events it has not written yet. Publish() formats an event once, on
+    // the calling thread, into a reference-counted buffer and wakes the loop through an
+    // eventfd; the loop then queues that same buffer on every subscriber, so fan-out
+    // costs one pointer copy and one send per connection. A subscriber that falls more
+    // than max_queued_events behind is disconnected instead of buffering without bound.
+    //
+    // Events published while nobody is subscribed are dropped. Publish and Ping may be
+    // called from any thread. Like HttpClient, a channel must only be destroyed after
+    // the server it is registered with has stopped.
+    class EventChannel : public IoWatcher {
+    public:
+        explicit EventChannel(EventChannelOptions options = {});
+
+        ~EventChannel() override;
+
+        EventChannel(const EventChannel &) = delete;
+
+        EventChannel &operator=(const EventChannel &) = delete;
+
+        //data可以有多行；event和id为空时不写这两个字段，它们本身不能包含换行
+        void Publish(std::string_view data, std::string_view event = {}, std::string_view id = {});
+
+        //SSE订阅者收到一行注释(防止代理因为连接空闲而断开)，长轮询的请求收到204后重新发起
+        //服务器不会自己发心跳，由应用按需要的间隔调用
+        void Ping();
+
+        //当前的订阅者数量
+        size_t subscribers() const { return subscriber_count_.load(std::memory_order_relaxed); }
+
+    private:
+        friend class HttpServer;
+
+        //一次发布：两种订阅方式各一份序列化好的字节，所有订阅者共用
+        struct Message {
+            std::shared_ptr<const std::string> frame;       //SSE事件
+            std::shared_ptr<const std::string> long_poll;   //完整的HTTP响应，没有长轮询路由时为空
+            std::uint16_t long_poll_status;
+        };
+
+        void Post(Message message);
+
+        //在事件循环线程上把等待中的消息交给server_
+        void OnEvents(std::uint32_t events) override;
+
+        EventChannelOptions options_;
+        int event_fd_;
+        HttpServer *server_ = nullptr;          //RegisterEventStream时设置
+        std::atomic<bool> has_long_poll_{false};
+
+        std::mutex mutex_;
+        std::vector<Message> pending_;
+
+        //只在事件循环线程上访问，Subscription::index是在这里的下标
+        std::vector<EventData *> subscribers_;
+        std::atomic<size_t> subscriber_count_{0};
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_EVENTCHANNEL_H
@@ -0,0 +1,524 @@
+#include "HttpClient.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace snow {
+    namespace {
+        enum class ParseStatus {
+            kIncomplete,
+            kDone,
+            kBad
+        };
+
+        bool ContainsIgnoreCase(std::string_view haystack, std::string_view needle) {
+            auto it = std::search(haystack.begin(), haystack.end(), needle.begin(), needle.end(),
+                                  [](unsigned char x, unsigned char y) { return std::tolower(x) == std::tolower(y); });
+            return it != haystack.end();
+        }
+
+        bool ParseSize(std::string_view text, int base, size_t *out) {
+            if (text.empty()) return false;
+            size_t value = 0;
+            for (char c : text) {
+                int digit;
+                if (c >= '0' && c <= '9') digit = c - '0';
+                else if (base == 16 && c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+                else if (base == 16 && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+                else return false;
+                if (value > (SIZE_MAX - digit) / base) return false;
+                value = value * base + digit;
+            }
+            *out = value;
+            return true;
+        }
+
+        //解码chunked body(RFC 7230 4.1)，data从第一个chunk-size开始
+        ParseStatus DecodeChunked(std::string_view data, std::string *body, size_t *consumed) {
+            size_t pos = 0;
+            while (true) {
+                size_t line_end = data.find("\r\n", pos);
+                if (line_end == std::string_view::npos) return ParseStatus::kIncomplete;
+                std::string_view size_text = data.substr(pos, line_end - pos);
+                size_text = size_text.substr(0, size_text.find(';'));  //忽略chunk-ext
+                while (!size_text.empty() && size_text.back() == ' ') size_text.remove_suffix(1);
+                size_t chunk_size;
+                if (!ParseSize(size_text, 16, &chunk_size)) return ParseStatus::kBad;
+                pos = line_end + 2;
+                if (chunk_size == 0) break;
+                if (data.size() - pos < chunk_size + 2) return ParseStatus::kIncomplete;
+                if (data.compare(pos + chunk_size, 2, "\r\n") != 0) return ParseStatus::kBad;
+                body->append(data.data() + pos, chunk_size);
+                pos += chunk_size + 2;
+            }
+            //跳过trailer，直到空行
+            while (true) {
+                size_t line_end = data.find("\r\n", pos);
+                if (line_end == std::string_view::npos) return ParseStatus::kIncomplete;
+                bool empty = line_end == pos;
+                pos = line_end + 2;
+                if (empty) break;
+            }
+            *consumed = pos;
+            return ParseStatus::kDone;
+        }
+
+        // Frames one response at the start of input. The body is delimited by
+        // Transfer-Encoding: chunked, Content-Length, or the connection closing; HEAD
+        // requests and 1xx/204/304 responses have none.
+        ParseStatus ParseResponse(std::string_view input, bool head_request, bool at_eof,
+                                  HttpResponse *response, size_t *consumed, bool *keep_alive) {
+            size_t head_end = input.find("\r\n\r\n");
+            if (head_end == std::string_view::npos) {
+                return at_eof ? ParseStatus::kBad : ParseStatus::kIncomplete;
+            }
+            std::string_view head = input.substr(0, head_end + 4);
+            std::string_view rest = input.substr(head.size());
+
+            try {
+                *response = StringToHttpResponse(head);
+            } catch (const std::exception &) {
+                return ParseStatus::kBad;
+            }
+            int status = static_cast<int>(response->getStatusCode());
+            *keep_alive = !ContainsIgnoreCase(FindHeaderValue(head, "Connection"), "close");
+
+            std::string body;
+            size_t body_size = 0;
+            if (head_request || (status >= 100 && status < 200) || status == 204 || status == 304) {
+                //没有body
+            } else if (ContainsIgnoreCase(FindHeaderValue(head, "Transfer-Encoding"), "chunked")) {
+                ParseStatus chunked = DecodeChunked(rest, &body, &body_size);
+                if (chunked != ParseStatus::kDone) {
+                    return chunked == ParseStatus::kIncomplete && at_eof ? ParseStatus::kBad : chunked;
+                }
+                response->removeHeader("Transfer-Encoding");
+            } else if (std::string_view length = FindHeaderValue(head, "Content-Length"); !length.empty()) {
+                if (!ParseSize(length, 10, &body_size)) return ParseStatus::kBad;
+                if (rest.size() < body_size) return at_eof ? ParseStatus::kBad : ParseStatus::kIncomplete;
+                body.assign(rest.substr(0, body_size));
+            } else {
+                //没有长度信息，body一直到连接关闭为止
+                if (!at_eof) return ParseStatus::kIncomplete;
+                body.assign(rest);
+                body_size = rest.size();
+                *keep_alive = false;
+            }
+
+            response->setContent(body);
+            *consumed = head.size() + body_size;
+            return ParseStatus::kDone;
+        }
+    } // namespace
+
+    HttpClient::HttpClient(HttpServer &server) : server_(server), timer_(this) {}
+
+    HttpClient::~HttpClient() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (timer_.fd != -1) {
+            server_.Unwatch(timer_.fd);
+            close(timer_.fd);
+        }
+        for (auto &entry : upstreams_) {
+            for (Connection *connection : entry.second->connections) {
+                server_.Unwatch(connection->fd);
+                close(connection->fd);
+                delete connection;
+            }
+        }
+        for (auto &generation : graveyard_) {
+            for (Connection *connection : generation) delete connection;
+        }
+    }
+
+    bool HttpClient::AddUpstream(const std::string &name, const std::string &address, std::uint16_t port,
+                                 UpstreamOptions options) {
+        auto upstream = std::make_unique<Upstream>();
+        upstream->name = name;
+
+        auto *v4 = reinterpret_cast<sockaddr_in *>(&upstream->address);
+        auto *v6 = reinterpret_cast<sockaddr_in6 *>(&upstream->address);
+        if (inet_pton(AF_INET, address.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port = htons(port);
+            upstream->address_length = sizeof(sockaddr_in);
+        } else if (inet_pton(AF_INET6, address.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = htons(port);
+            upstream->address_length = sizeof(sockaddr_in6);
+        } else {
+            return false;
+        }
+
+        if (options.host.empty()) {
+            bool is_v6 = upstream->address.ss_family == AF_INET6;
+            options.host = (is_v6 ? "[" + address + "]" : address) + ":" + std::to_string(port);
+        }
+        options.max_connections = std::max<size_t>(options.max_connections, 1);
+        options.max_pipeline_depth = std::max<size_t>(options.max_pipeline_depth, 1);
+        upstream->options = std::move(options);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        upstreams_[name] = std::move(upstream);
+        return true;
+    }
+
+    HttpClient::Awaiter HttpClient::Send(const std::string &upstream, HttpRequest request) {
+        auto it = upstreams_.find(upstream);
+        Awaiter awaiter(this, it == upstreams_.end() ? nullptr : it->second.get());
+        if (!awaiter.upstream_) {
+            awaiter.call_.result.error = HttpClientError::kUnknownUpstream;
+            return awaiter;
+        }
+
+        if (request.getHeadersValue("Host").empty()) {
+            request.setHeader("Host", awaiter.upstream_->options.host);
+        }
+        HttpMethod method = request.getMethod();
+        awaiter.call_.head = method == HttpMethod::HEAD;
+        awaiter.call_.pipelinable = method == HttpMethod::GET || method == HttpMethod::HEAD;
+        awaiter.call_.bytes = HttpRequestToString(request);
+        return awaiter;
+    }
+
+    HttpClient::Awaiter HttpClient::Get(const std::string &upstream, std::string_view target) {
+        UriView view;
+        if (!ParseRequestTarget(target, &view) || view.path.empty() || view.path.front() != '/') {
+            Awaiter awaiter(this, nullptr);
+            awaiter.call_.result.error = HttpClientError::kInvalidRequest;
+            return awaiter;
+        }
+        HttpRequest request;
+        request.setMethod(HttpMethod::GET);
+        request.setUri(Uri(view));
+        return Send(upstream, std::move(request));
+    }
+
+    bool HttpClient::Submit(Upstream *upstream, Call *call, std::experimental::coroutine_handle<> waiter) {
+        call->waiter = waiter;
+        call->deadline = Clock::now() + upstream->options.request_timeout;
+
+        ReadyList ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!started_) {
+                //第一个请求时才创建定时器，此时服务器已经启动，事件循环已经存在
+                timer_.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                itimerspec spec{};
+                spec.it_interval.tv_nsec = std::chrono::nanoseconds(kTickInterval).count();
+                spec.it_value = spec.it_interval;
+                if (timer_.fd == -1 || timerfd_settime(timer_.fd, 0, &spec, nullptr) == -1 ||
+                    !server_.Watch(timer_.fd, EPOLLIN, &timer_)) {
+                    if (timer_.fd != -1) close(timer_.fd);
+                    timer_.fd = -1;
+                    call->result.error = HttpClientError::kConnectFailed;
+                    return false;
+                }
+                started_ = true;
+            }
+            upstream->waiting.push_back(call);
+            Assign(upstream, &ready);
+        }
+
+        //A call that failed straight away must not be resumed from inside its own
+        //await_suspend; returning false resumes it instead.
+        bool suspended = true;
+        auto self = std::find(ready.begin(), ready.end(), call);
+        if (self != ready.end()) {
+            ready.erase(self);
+            suspended = false;
+        }
+        Resume(ready);
+        return suspended;
+    }
+
+    // Hands waiting calls to connections: an idle connection first, then a new one
+    // while the pool has room, then pipelining behind other GET/HEAD requests.
+    void HttpClient::Assign(Upstream *upstream, ReadyList *ready) {
+        const UpstreamOptions &options = upstream->options;
+        while (!upstream->waiting.empty()) {
+            Call *call = upstream->waiting.front();
+
+            Connection *target = nullptr;
+            for (Connection *connection : upstream->connections) {
+                if (connection->in_flight.empty()) {
+                    target = connection;
+                    break;
+                }
+            }
+            if (!target && upstream->connections.size() < options.max_connections) {
+                target = Connect(upstream);
+                if (!target) {
+                    upstream->waiting.pop_front();
+                    Complete(call, HttpClientError::kConnectFailed, ready);
+                    continue;
+                }
+            }
+            if (!target && call->pipelinable) {
+                size_t shortest = options.max_pipeline_depth;
+                for (Connection *connection : upstream->connections) {
+                    bool pipelinable = std::all_of(connection->in_flight.begin(), connection->in_flight.end(),
+                                                   [](const Call *c) { return c->pipelinable; });
+                    if (pipelinable && connection->in_flight.size() < shortest) {
+                        target = connection;
+                        shortest = connection->in_flight.size();
+                    }
+                }
+            }
+            if (!target) {
+                return;     //等待有连接空闲下来
+            }
+
+            upstream->waiting.pop_front();
+            target->in_flight.push_back(call);
+            target->output += call->bytes;
+            if (target->connected) {
+                Flush(target, ready);
+            }
+        }
+    }
+
+    HttpClient::Connection *HttpClient::Connect(Upstream *upstream) {
+        int fd = socket(upstream->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            return nullptr;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&upstream->address), upstream->address_length) == -1 &&
+            errno != EINPROGRESS) {
+            close(fd);
+            return nullptr;
+        }
+
+        auto *connection = new Connection(this, upstream, fd);
+        connection->connect_deadline = Clock::now() + upstream->options.connect_timeout;
+        //连接完成时socket变为可写
+        connection->interest = EPOLLIN | EPOLLOUT;
+        if (!server_.Watch(fd, connection->interest, connection)) {
+            close(fd);
+            delete connection;
+            return nullptr;
+        }
+        upstream->connections.push_back(connection);
+        return connection;
+    }
+
+    void HttpClient::Flush(Connection *connection, ReadyList *ready) {
+        while (!connection->output.empty()) {
+            ssize_t written = send(connection->fd, connection->output.data(), connection->output.size(), MSG_NOSIGNAL);
+            if (written > 0) {
+                connection->output.erase(0, static_cast<size_t>(written));
+            } else if (written == -1 && errno == EINTR) {
+                continue;
+            } else if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                CloseConnection(connection, HttpClientError::kConnectionClosed, ready);
+                return;
+            }
+        }
+        UpdateInterest(connection);
+    }
+
+    void HttpClient::UpdateInterest(Connection *connection) {
+        //水平触发：只有在还有数据没写完时才关心EPOLLOUT
+        std::uint32_t interest = EPOLLIN;
+        if (!connection->connected || !connection->output.empty()) interest |= EPOLLOUT;
+        if (interest != connection->interest) {
+            connection->interest = interest;
+            server_.Rewatch(connection->fd, interest, connection);
+        }
+    }
+
+    void HttpClient::OnConnectionEvents(Connection *connection, std::uint32_t events) {
+        Upstream *upstream = connection->upstream;
+        ReadyList ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (connection->closed) {
+                return;
+            }
+
+            if (!connection->connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+                    CloseConnection(connection, HttpClientError::kConnectFailed, &ready);
+                } else {
+                    connection->connected = true;
+                    connection->idle_since = Clock::now();
+                }
+            }
+            if (!connection->closed && connection->connected && (events & EPOLLOUT)) {
+                Flush(connection, &ready);
+            }
+            if (!connection->closed && connection->connected && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                ReadResponses(connection, &ready);
+            }
+            //连接可能空闲下来了，或者有请求需要重试，把排队的请求分配出去
+            Assign(upstream, &ready);
+        }
+        Resume(ready);
+    }
+
+    void HttpClient::ReadResponses(Connection *connection, ReadyList *ready) {
+        bool at_eof = false;
+        char buffer[kMaxBufferSize];
+        while (true) {
+            ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                connection->input.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            at_eof = true;      //对端关闭或者出错
+            break;
+        }
+
+        while (!connection->in_flight.empty()) {
+            if (at_eof && connection->input.empty()) {
+                break;      //没有收到任何响应数据，连接就被关闭了
+            }
+            Call *call = connection->in_flight.front();
+            HttpResponse response;
+            size_t consumed = 0;
+            bool keep_alive = true;
+            ParseStatus status = ParseResponse(connection->input, call->head, at_eof, &response, &consumed, &keep_alive);
+            if (status == ParseStatus::kIncomplete) {
+                break;
+            }
+            if (status == ParseStatus::kBad) {
+                CloseConnection(connection, HttpClientError::kBadResponse, ready);
+                return;
+            }
+            connection->input.erase(0, consumed);
+            if (static_cast<int>(response.getStatusCode()) < 200) {
+                continue;   //1xx是中间响应，最终响应还在后面
+            }
+
+            connection->in_flight.pop_front();
+            ++connection->responses;
+            call->result.response = std::move(response);
+            Complete(call, HttpClientError::kOk, ready);
+            connection->idle_since = Clock::now();
+            if (!keep_alive) {
+                at_eof = true;
+                break;
+            }
+        }
+
+        if (at_eof) {
+            //剩下的请求已经没有机会收到响应
+            CloseConnection(connection, HttpClientError::kConnectionClosed, ready);
+        }
+    }
+
+    void HttpClient::CloseConnection(Connection *connection, HttpClientError error, ReadyList *ready) {
+        if (connection->closed) {
+            return;
+        }
+        connection->closed = true;
+        server_.Unwatch(connection->fd);
+        close(connection->fd);
+
+        // A server may close a keep-alive connection just as a new request is sent on
+        // it. GET and HEAD are safe to repeat, so they get one more try on another
+        // connection; everything else fails with the error.
+        bool reused = connection->responses > 0;
+        auto &waiting = connection->upstream->waiting;
+        for (auto it = connection->in_flight.rbegin(); it != connection->in_flight.rend(); ++it) {
+            Call *call = *it;
+            if (error == HttpClientError::kConnectionClosed && reused && call->pipelinable && !call->retried) {
+                //重试时不再pipeline，避免再次排在一个会被关闭的请求后面
+                call->retried = true;
+                call->pipelinable = false;
+                waiting.push_front(call);
+            } else {
+                Complete(call, error, ready);
+            }
+        }
+        connection->in_flight.clear();
+
+        auto &connections = connection->upstream->connections;
+        connections.erase(std::find(connections.begin(), connections.end(), connection));
+        graveyard_[0].push_back(connection);
+    }
+
+    void HttpClient::Timer::OnEvents(std::uint32_t) {
+        std::uint64_t expirations;
+        while (read(fd, &expirations, sizeof(expirations)) > 0) {}
+        client_->OnTick();
+    }
+
+    void HttpClient::OnTick() {
+        ReadyList ready;
+        std::vector<Connection *> expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Clock::time_point now = Clock::now();
+
+            for (Connection *connection : graveyard_[1]) delete connection;
+            graveyard_[1].swap(graveyard_[0]);
+            graveyard_[0].clear();
+
+            for (auto &entry : upstreams_) {
+                Upstream *upstream = entry.second.get();
+
+                //排队中超时的请求
+                auto &waiting = upstream->waiting;
+                for (auto it = waiting.begin(); it != waiting.end();) {
+                    if ((*it)->deadline <= now) {
+                        Complete(*it, HttpClientError::kTimeout, &ready);
+                        it = waiting.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+
+                //CloseConnection会修改connections，先复制一份
+                std::vector<Connection *> connections = upstream->connections;
+                for (Connection *connection : connections) {
+                    if (!connection->connected) {
+                        if (connection->connect_deadline <= now) {
+                            CloseConnection(connection, HttpClientError::kConnectFailed, &ready);
+                        }
+                    } else if (!connection->in_flight.empty()) {
+                        //响应按顺序返回，队首超时就意味着后面的请求也要等它
+                        if (connection->in_flight.front()->deadline <= now) {
+                            CloseConnection(connection, HttpClientError::kTimeout, &ready);
+                        }
+                    } else if (connection->idle_since + upstream->options.idle_timeout <= now) {
+                        CloseConnection(connection, HttpClientError::kOk, &ready);
+                    }
+                }
+                Assign(upstream, &ready);
+            }
+        }
+        Resume(ready);
+    }
+
+    void HttpClient::Complete(Call *call, HttpClientError error, ReadyList *ready) {
+        call->result.error = error;
+        ready->push_back(call);
+    }
+
+    void HttpClient::Resume(const ReadyList &ready) {
+        for (Call *call : ready) {
+            //resume之后call所在的协程帧可能已经被销毁
+            call->waiter.resume();
+        }
+    }
+
+} // snow
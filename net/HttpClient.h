@@ -0,0 +1,210 @@
+#ifndef SNOW_HTTP_SERVER_HTTPCLIENT_H
+#define SNOW_HTTP_SERVER_HTTPCLIENT_H
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <experimental/coroutine>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "http/http_message.h"
+#include "HttpServer.h"
+
+namespace snow {
+
+    enum class HttpClientError {
+        kOk,
+        kUnknownUpstream,   //Send()的upstream没有用AddUpstream注册
+        kInvalidRequest,
+        kConnectFailed,
+        kTimeout,           //超过request_timeout还没有收到完整响应(包括排队时间)
+        kConnectionClosed,  //响应收完之前连接被关闭
+        kBadResponse        //无法解析的响应
+    };
+
+    struct HttpClientResult {
+        HttpClientError error = HttpClientError::kOk;
+        HttpResponse response;
+
+        bool ok() const { return error == HttpClientError::kOk; }
+    };
+
+    //每个upstream的连接池配置
+    struct UpstreamOptions {
+        size_t max_connections = 8;
+        //一个连接上最多排队的请求数，只有GET和HEAD会pipeline，1表示不pipeline
+        size_t max_pipeline_depth = 4;
+        std::chrono::milliseconds connect_timeout{1000};
+        std::chrono::milliseconds request_timeout{5000};
+        //keep-alive连接空闲超过这个时间后关闭
+        std::chrono::milliseconds idle_timeout{30000};
+        //每个请求发送的Host header，为空时使用"address:port"
+        std::string host;
+    };
+
+    // Asynchronous HTTP/1.1 client driven by an HttpServer's event loop.
+    //
+    // Upstreams are configured with numeric addresses, so no request ever waits on name
+    // resolution. Each upstream keeps a pool of keep-alive connections; a request takes
+    // an idle connection, opens a new one while the pool is below max_connections, is
+    // pipelined behind other GET/HEAD requests, or waits for a connection to free up.
+    //
+    // Requests are issued from CoroTask handlers:
+    //
+    //     HttpClientResult result = co_await client.Get("users", "/users/42");
+    //
+    // The handler's coroutine is resumed on the event loop thread once the response
+    // arrives, so code after co_await should not block. All methods are thread-safe.
+    class HttpClient {
+    public:
+        class Awaiter;
+
+        explicit HttpClient(HttpServer &server);
+
+        // Must only be destroyed after the server has stopped; handlers still waiting
+        // on a response are never resumed.
+        ~HttpClient();
+
+        HttpClient(const HttpClient &) = delete;
+
+        HttpClient &operator=(const HttpClient &) = delete;
+
+        //注册一个upstream，address必须是数字形式的IPv4/IPv6地址，地址无效时返回false
+        //需要在开始发送请求之前调用
+        bool AddUpstream(const std::string &name, const std::string &address, std::uint16_t port,
+                         UpstreamOptions options = {});
+
+        Awaiter Send(const std::string &upstream, HttpRequest request);
+
+        //target是origin-form，例如"/users/42?verbose=1"
+        Awaiter Get(const std::string &upstream, std::string_view target);
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // The timer drives connect, request and idle timeouts.
+        static constexpr std::chrono::milliseconds kTickInterval{10};
+
+        struct Upstream;
+
+        // One request: its serialized bytes and where to deliver the result. Lives in
+        // the awaiting coroutine's frame, which stays suspended until the call completes.
+        struct Call {
+            std::string bytes;
+            bool pipelinable = false;   //GET和HEAD
+            bool head = false;          //HEAD的响应没有body
+            bool retried = false;
+            Clock::time_point deadline;
+            HttpClientResult result;
+            std::experimental::coroutine_handle<> waiter;
+        };
+
+        struct Connection : IoWatcher {
+            Connection(HttpClient *owner, Upstream *upstream, int fd) : client(owner), upstream(upstream), fd(fd) {}
+
+            void OnEvents(std::uint32_t events) override { client->OnConnectionEvents(this, events); }
+
+            HttpClient *client;
+            Upstream *upstream;
+            int fd;
+            bool connected = false;
+            bool closed = false;        //已经关闭，还在graveyard中等待释放
+            size_t responses = 0;       //已经在这个连接上收到的响应数
+            std::uint32_t interest = 0; //当前注册的epoll事件
+            Clock::time_point connect_deadline;
+            Clock::time_point idle_since;
+            std::string output;         //还没有写出的请求
+            std::string input;          //还没有解析的响应数据
+            std::deque<Call *> in_flight;   //已经分配到这个连接，按发送顺序等待响应
+        };
+
+        struct Upstream {
+            std::string name;
+            sockaddr_storage address{};
+            socklen_t address_length = 0;
+            UpstreamOptions options;
+            std::vector<Connection *> connections;
+            std::deque<Call *> waiting;     //还没有分配到连接的请求
+        };
+
+        class Timer : public IoWatcher {
+        public:
+            explicit Timer(HttpClient *client) : client_(client) {}
+
+            void OnEvents(std::uint32_t events) override;
+
+            int fd = -1;
+
+        private:
+            HttpClient *client_;
+        };
+
+        //Calls completed while mutex_ was held, resumed after it is released.
+        using ReadyList = std::vector<Call *>;
+
+        HttpServer &server_;
+        std::mutex mutex_;
+        //只在AddUpstream中修改，之后只读
+        std::map<std::string, std::unique_ptr<Upstream>, std::less<>> upstreams_;
+        Timer timer_;
+        bool started_ = false;
+        //Closed connections may still appear in an epoll batch being processed on the
+        //loop thread, so they are freed two timer ticks after being closed.
+        std::vector<Connection *> graveyard_[2];
+
+        // Returns false when the call completed without suspending.
+        bool Submit(Upstream *upstream, Call *call, std::experimental::coroutine_handle<> waiter);
+
+        void Assign(Upstream *upstream, ReadyList *ready);
+
+        Connection *Connect(Upstream *upstream);
+
+        void Flush(Connection *connection, ReadyList *ready);
+
+        void UpdateInterest(Connection *connection);
+
+        void OnConnectionEvents(Connection *connection, std::uint32_t events);
+
+        void ReadResponses(Connection *connection, ReadyList *ready);
+
+        void CloseConnection(Connection *connection, HttpClientError error, ReadyList *ready);
+
+        void OnTick();
+
+        static void Complete(Call *call, HttpClientError error, ReadyList *ready);
+
+        static void Resume(const ReadyList &ready);
+    };
+
+    // Returned by Send() and Get(); co_await it inside a CoroTask handler.
+    class HttpClient::Awaiter {
+    public:
+        bool await_ready() const noexcept { return call_.result.error != HttpClientError::kOk; }
+
+        // The call may complete on the loop thread before this returns, so nothing in
+        // the awaiter is touched after Submit().
+        bool await_suspend(std::experimental::coroutine_handle<> waiter) {
+            return client_->Submit(upstream_, &call_, waiter);
+        }
+
+        HttpClientResult await_resume() { return std::move(call_.result); }
+
+    private:
+        friend class HttpClient;
+
+        Awaiter(HttpClient *client, Upstream *upstream) : client_(client), upstream_(upstream) {}
+
+        HttpClient *client_;
+        Upstream *upstream_;
+        Call call_;
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_HTTPCLIENT_H
@@ -6,18 +6,30 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
 #include <string.h>
-#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <ctime>
 #include <iostream>
 
-#include "http/http_parser.h"
+#include "http/ByteRange.h"
+#include "http/HttpTokens.h"
+#include "http/RequestArena.h"
+#include "EventChannel.h"
+#include "Tracer.h"
 
 namespace snow {
 
@@ -31,87 +43,446 @@ namespace snow {
             flags |= O_NONBLOCK;
             return fcntl(fd, F_SETFL, flags) != -1;
         }
+
+#ifndef EPIOCSPARAMS
+        // Epoll busy-poll parameters (Linux 6.9); defined here for older headers.
+        struct epoll_params {
+            std::uint32_t busy_poll_usecs;
+            std::uint16_t busy_poll_budget;
+            std::uint8_t prefer_busy_poll;
+            std::uint8_t pad;
+        };
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+        constexpr std::chrono::microseconds kMinSpin{5};
+
+        // Every connection fd is registered one-shot: an event disarms it, and whoever
+        // handles the event owns the connection until it re-arms the fd (HttpServer::Arm).
+        constexpr std::uint32_t kArmFlags = EPOLLET | EPOLLONESHOT;
+
+        // Every response closes its connection, see SetResponse
+        constexpr std::string_view kConnectionClose = "Connection: close\r\n";
+
+        // Sent once to an SSE subscriber; the stream has no length and ends with the
+        // connection. X-Accel-Buffering keeps nginx-style proxies from holding events back.
+        const std::string kEventStreamHeaders = "HTTP/1.1 200 OK\r\n"
+                                                "Content-Type: text/event-stream\r\n"
+                                                "Cache-Control: no-cache\r\n"
+                                                "X-Accel-Buffering: no\r\n"
+                                                "Connection: close\r\n\r\n";
+
+        // read(2) and send(2) on a connection, through TLS when it has a session
+        ssize_t Receive(EventData* event, void* buffer, size_t length) {
+            return event->tls ? event->tls->Read(buffer, length) : read(event->fd, buffer, length);
+        }
+
+        ssize_t Send(EventData* event, const void* data, size_t length) {
+            return event->tls ? event->tls->Write(data, length) : send(event->fd, data, length, MSG_NOSIGNAL);
+        }
+
+        // The answer for a request whose handler threw
+        HttpResponse InternalServerError() {
+            HttpResponse response;
+            response.setStatusCode(HttpStatusCode::InternalServerError);
+            response.setContent("<html><body><h1>500 Internal Server Error</h1></body></html>");
+            return response;
+        }
+
+        // "METHOD target" from the start of a request, for the access log
+        std::string_view RequestLine(std::string_view request) {
+            std::string_view line = request.substr(0, request.find_first_of("\r\n"));
+            size_t method_end = line.find(' ');
+            if (method_end != std::string_view::npos) {
+                line = line.substr(0, line.find(' ', method_end + 1));
+            }
+            return line;
+        }
+
+        // Whether the request in data can be dispatched: its headers have ended and a
+        // Content-Length body, if any, is all there. Chunked bodies and clients waiting
+        // for 100 Continue are dispatched at the end of the headers, and so is anything
+        // whose framing does not parse, for the parser to reject.
+        bool RequestComplete(std::string_view data) {
+            size_t head_end = data.find("\r\n\r\n");
+            if (head_end == std::string_view::npos) {
+                return false;
+            }
+            std::string_view head = data.substr(0, head_end + 2);
+            std::string_view content_length = FindHeaderValue(head, "Content-Length");
+            if (content_length.empty() || !FindHeaderValue(head, "Transfer-Encoding").empty() ||
+                !FindHeaderValue(head, "Expect").empty()) {
+                return true;
+            }
+            size_t length = 0;
+            auto [end, error] = std::from_chars(content_length.data(), content_length.data() + content_length.size(),
+                                                length);
+            if (error != std::errc() || end != content_length.data() + content_length.size()) {
+                return true;
+            }
+            return data.size() - (head_end + 4) >= length;
+        }
+
+        // Whether the last coding in a Transfer-Encoding value is chunked, which is what
+        // frames the body; codings before it are left to the upload sink.
+        bool FinalCodingIsChunked(std::string_view transfer_encoding) {
+            size_t comma = transfer_encoding.rfind(',');
+            std::string_view coding = comma == std::string_view::npos ? transfer_encoding
+                                                                      : transfer_encoding.substr(comma + 1);
+            size_t begin = coding.find_first_not_of(" \t");
+            size_t end = coding.find_last_not_of(" \t");
+            return begin != std::string_view::npos && EqualsIgnoreCase(coding.substr(begin, end - begin + 1), "chunked");
+        }
+
+        // Parses "ipv4:port", "[ipv6]:port", "unix:/path" or "unix:@abstract" into a
+        // socket address. Only numeric addresses are accepted, so this never blocks on DNS.
+        bool ParseEndpoint(const std::string& endpoint, sockaddr_storage* addr, socklen_t* addr_len,
+                           std::string* unix_path) {
+            memset(addr, 0, sizeof(*addr));
+            constexpr std::string_view kUnixPrefix = "unix:";
+            if (endpoint.compare(0, kUnixPrefix.size(), kUnixPrefix) == 0) {
+                std::string_view name = std::string_view(endpoint).substr(kUnixPrefix.size());
+                auto* un = reinterpret_cast<sockaddr_un*>(addr);
+                // An abstract name is not NUL-terminated, a path is.
+                if (name.empty() || name.size() >= sizeof(un->sun_path)) {
+                    return false;
+                }
+                un->sun_family = AF_UNIX;
+                if (name[0] == '@') {
+                    un->sun_path[0] = '\0';
+                    memcpy(un->sun_path + 1, name.data() + 1, name.size() - 1);
+                    *addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + name.size());
+                } else {
+                    memcpy(un->sun_path, name.data(), name.size());
+                    *addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + name.size() + 1);
+                    *unix_path = std::string(name);
+                }
+                return true;
+            }
+
+            size_t colon = endpoint.rfind(':');
+            if (colon == std::string::npos) {
+                return false;
+            }
+            std::uint16_t port = 0;
+            const char* port_begin = endpoint.data() + colon + 1;
+            const char* port_end = endpoint.data() + endpoint.size();
+            auto [end, ec] = std::from_chars(port_begin, port_end, port);
+            if (ec != std::errc() || end != port_end || port_begin == port_end) {
+                return false;
+            }
+            std::string host = endpoint.substr(0, colon);
+            if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+                auto* in6 = reinterpret_cast<sockaddr_in6*>(addr);
+                in6->sin6_family = AF_INET6;
+                in6->sin6_port = htons(port);
+                *addr_len = sizeof(sockaddr_in6);
+                return inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(), &in6->sin6_addr) == 1;
+            }
+            auto* in = reinterpret_cast<sockaddr_in*>(addr);
+            in->sin_family = AF_INET;
+            in->sin_port = htons(port);
+            *addr_len = sizeof(sockaddr_in);
+            return inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1;
+        }
     } // namespace
 
+    ListenerOptions ListenerOptions::LowLatency() {
+        ListenerOptions options;
+        options.tcp_nodelay = true;
+        options.defer_accept_seconds = 1;
+        options.fast_open_queue = 256;
+        options.busy_poll_us = 50;
+        options.prefer_busy_poll = true;
+        options.spin_before_block = std::chrono::microseconds(100);
+        return options;
+    }
+
     HttpServer::HttpServer(const std::string &host, std::uint16_t port)
             : host_(host),
               port_(port),
-              sock_fd(-1),
+              epoll_fd_(-1),
               running_(false),
-            // Assuming a ThreadPool size is defined somewhere or passed to the constructor.
-            // Based on the old code, a constant kThreadPoolSize was used.
-            // We'll assume a default of 5 for this example.
-              thread_pool_(5),
               rng_(std::chrono::high_resolution_clock::now().time_since_epoch().count()),
-              sleep_times_(1, 5) {}
+              sleep_times_(1, 5),
+            // Sized from the host's CPU count; SetWorkerPoolSizing can override it.
+              thread_pool_(PoolSizing::ForHardware()) {}
 
-    void HttpServer::Start() {
+    bool HttpServer::Start() {
+        if (access_log_ && !access_log_->Start()) {
+            return false;
+        }
+        // Listeners added before an earlier Stop() kept their configuration but not
+        // their sockets.
+        for (auto& listener : listeners_) {
+            if (listener->fd == -1 && !CreateSocket(listener.get())) {
+                Stop();
+                return false;
+            }
+        }
+        if (!host_.empty()) {
+            std::string endpoint = host_.find(':') == std::string::npos ? host_ : "[" + host_ + "]";
+            if (!AddListener(endpoint + ":" + std::to_string(port_), listener_options_)) {
+                Stop();
+                return false;
+            }
+            listeners_.back()->from_host = true;
+        }
+        if (!completions_) {
+            completions_ = std::make_unique<CompletionQueue>();
+        }
+        SetUpEpoll();
+        if (epoll_fd_ == -1) {
+            Stop();
+            return false;
+        }
+        for (EventChannel* channel : channels_) {
+            if (channel->event_fd_ == -1 || !Watch(channel->event_fd_, EPOLLIN, channel)) {
+                // Subscribers of this channel would never get an event
+                Stop();
+                return false;
+            }
+        }
         running_ = true;
-        CreateSocket();
-        Listen();
+
+        // Pin before the first request, so whatever the threads allocate for themselves
+        // is first touched, and therefore placed, on their own NUMA node.
+        thread_pool_.pin(topology_.worker_cpus);
+        if (dedicated_pool_) {
+            dedicated_pool_->pin(topology_.dedicated_worker_cpus);
+        }
+        if (topology_.loop_cpu >= 0) {
+            for (int irq : topology_.rx_queue_irqs) {
+                SetIrqAffinity(irq, topology_.loop_cpu);
+            }
+        }
         listener_thread_ = std::thread(&HttpServer::Listen, this);
+        return true;
     }
 
     void HttpServer::Stop() {
         running_ = false;
-        if (sock_fd != -1) {
-            close(sock_fd);
+        if (completions_) {
+            // A loop blocked in epoll_wait would not notice running_ otherwise
+            completions_->Wake();
+        }
+        for (auto& listener : listeners_) {
+            if (listener->fd != -1) {
+                close(listener->fd);
+                listener->fd = -1;
+            }
         }
         if (listener_thread_.joinable()) {
             listener_thread_.join();
         }
+        if (epoll_fd_ != -1) {
+            close(epoll_fd_);
+            epoll_fd_ = -1;
+        }
+        for (auto& listener : listeners_) {
+            if (!listener->unix_path.empty()) {
+                unlink(listener->unix_path.c_str());
+            }
+        }
+        // The rest are re-created by the next Start()
+        listeners_.erase(std::remove_if(listeners_.begin(), listeners_.end(),
+                                        [](const std::unique_ptr<Listener>& listener) { return listener->from_host; }),
+                         listeners_.end());
+        // completions_ stays: handlers still queued or running in the pools push onto it
+        // until the pools are destroyed, which happens before it (see the member order).
+        if (access_log_) {
+            access_log_->Stop();
+        }
+    }
+
+    bool HttpServer::AddListener(const std::string& endpoint, const ListenerOptions& options) {
+        auto listener = std::make_unique<Listener>();
+        listener->endpoint = endpoint;
+        listener->options = options;
+        if (!CreateSocket(listener.get())) {
+            return false;
+        }
+        listeners_.push_back(std::move(listener));
+        return true;
     }
 
-    void HttpServer::CreateSocket() {
-        sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    bool HttpServer::AddTlsListener(const std::string& endpoint, std::shared_ptr<TlsContext> tls,
+                                    const ListenerOptions& options) {
+        if (!tls || !AddListener(endpoint, options)) {
+            return false;
+        }
+        listeners_.back()->tls = std::move(tls);
+        return true;
+    }
+
+    bool HttpServer::CreateSocket(Listener* listener) {
+        sockaddr_storage serv_addr;
+        socklen_t serv_addr_len = 0;
+        if (!ParseEndpoint(listener->endpoint, &serv_addr, &serv_addr_len, &listener->unix_path)) {
+            return false;
+        }
+        int family = serv_addr.ss_family;
+        int sock_fd = socket(family, SOCK_STREAM, 0);
         if (sock_fd == -1) {
             // Handle error
-            return;
+            return false;
         }
 
         // Set socket options and bind
         int on = 1;
-        setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-        struct sockaddr_in serv_addr;
-        memset(&serv_addr, 0, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = inet_addr(host_.c_str());
-        serv_addr.sin_port = htons(port_);
-
-        if (bind(sock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) == -1) {
+        // Accepted sockets inherit these, so connections need no extra syscalls.
+        // All of them are optimizations; a kernel that refuses one still serves.
+        const ListenerOptions& options = listener->options;
+        if (family != AF_UNIX) {
+            setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (family == AF_INET6) {
+                // Keep "[::]:port" from also claiming the IPv4 port, which may be its own listener.
+                setsockopt(sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+            }
+            if (options.tcp_nodelay) {
+                setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            if (options.defer_accept_seconds > 0) {
+                setsockopt(sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.defer_accept_seconds,
+                           sizeof(options.defer_accept_seconds));
+            }
+            if (options.fast_open_queue > 0) {
+                setsockopt(sock_fd, IPPROTO_TCP, TCP_FASTOPEN, &options.fast_open_queue,
+                           sizeof(options.fast_open_queue));
+            }
+            if (options.busy_poll_us > 0) {
+                setsockopt(sock_fd, SOL_SOCKET, SO_BUSY_POLL, &options.busy_poll_us, sizeof(options.busy_poll_us));
+            }
+            if (options.prefer_busy_poll) {
+                setsockopt(sock_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+            }
+        } else if (!listener->unix_path.empty()) {
+            // A socket file left behind by a previous run makes bind fail; anything
+            // other than a socket is not ours to remove. Only a socket nobody listens
+            // on refuses a connection, so one that accepts it, or fails for another
+            // reason, may belong to a live server and is left alone.
+            struct stat st;
+            if (lstat(listener->unix_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+                int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                bool stale = probe != -1 && connect(probe, (struct sockaddr*)&serv_addr, serv_addr_len) == -1 &&
+                             errno == ECONNREFUSED;
+                if (probe != -1) {
+                    close(probe);
+                }
+                if (!stale) {
+                    close(sock_fd);
+                    return false;
+                }
+                unlink(listener->unix_path.c_str());
+            }
+        }
+
+        if (bind(sock_fd, (struct sockaddr*)&serv_addr, serv_addr_len) == -1) {
             // Handle error
             close(sock_fd);
-            return;
+            return false;
         }
 
         if (listen(sock_fd, kBackLogSize) == -1) {
             // Handle error
             close(sock_fd);
-            return;
+            if (!listener->unix_path.empty()) {
+                unlink(listener->unix_path.c_str());
+            }
+            return false;
         }
 
         SetNonBlocking(sock_fd);
+        listener->fd = sock_fd;
+        return true;
     }
 
-    void HttpServer::Listen() {
-        int epoll_fd = epoll_create1(0);
-        if (epoll_fd == -1) {
+    void HttpServer::SetUpEpoll() {
+        epoll_fd_ = epoll_create1(0);
+        if (epoll_fd_ == -1) {
             // Handle error
             return;
         }
 
+        // One loop serves every listener, so the loop-wide settings take the most
+        // aggressive value any listener asked for.
+        epoll_params params{};
+        spin_limit_ = std::chrono::microseconds(0);
+        for (const auto& listener : listeners_) {
+            const ListenerOptions& options = listener->options;
+            if (options.busy_poll_us > static_cast<int>(params.busy_poll_usecs)) {
+                params.busy_poll_usecs = static_cast<std::uint32_t>(options.busy_poll_us);
+            }
+            params.prefer_busy_poll |= options.prefer_busy_poll;
+            spin_limit_ = std::max(spin_limit_, options.spin_before_block);
+        }
+        if (params.busy_poll_usecs > 0) {
+            // Lets epoll_wait itself busy-poll the NIC queues of its sockets
+            params.busy_poll_budget = 8;
+            ioctl(epoll_fd_, EPIOCSPARAMS, &params);
+        }
+
+        // Level-triggered: a batch left over after a wakeup is simply reported again
+        epoll_event completion_event;
+        completion_event.events = EPOLLIN;
+        completion_event.data.u64 = reinterpret_cast<std::uintptr_t>(completions_.get()) | kCompletionTag;
+        if (!completions_->valid() ||
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, completions_->fd(), &completion_event) == -1) {
+            close(epoll_fd_);
+            epoll_fd_ = -1;
+            return;
+        }
+
+        for (const auto& listener : listeners_) {
+            epoll_event event;
+            event.events = EPOLLIN | EPOLLET;
+            event.data.u64 = reinterpret_cast<std::uintptr_t>(listener.get()) | kListenerTag;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listener->fd, &event) == -1) {
+                // Handle error
+                close(epoll_fd_);
+                epoll_fd_ = -1;
+                return;
+            }
+        }
+    }
+
+    bool HttpServer::Watch(int fd, std::uint32_t events, IoWatcher* watcher) {
         epoll_event event;
-        event.events = EPOLLIN | EPOLLET;
-        event.data.fd = sock_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &event) == -1) {
-            // Handle error
-            close(epoll_fd);
+        event.events = events;
+        event.data.u64 = reinterpret_cast<std::uintptr_t>(watcher) | kWatcherTag;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    bool HttpServer::Rewatch(int fd, std::uint32_t events, IoWatcher* watcher) {
+        epoll_event event;
+        event.events = events;
+        event.data.u64 = reinterpret_cast<std::uintptr_t>(watcher) | kWatcherTag;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == 0;
+    }
+
+    void HttpServer::Unwatch(int fd) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void HttpServer::Listen() {
+        int epoll_fd = epoll_fd_;
+        if (epoll_fd == -1) {
             return;
         }
+        if (topology_.loop_cpu >= 0) {
+            PinCurrentThread(topology_.loop_cpu);
+        }
+        // sendfile and OpenSSL's writes have no MSG_NOSIGNAL; with SIGPIPE blocked on
+        // this thread a vanished client is reported as EPIPE instead of killing the server.
+        sigset_t sigpipe;
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
 
         epoll_event events[kMaxEvents];
+        std::chrono::microseconds spin = spin_limit_;
         while (running_) {
-            int num_events = epoll_wait(epoll_fd, events, kMaxEvents, -1);
+            int num_events = WaitForEvents(epoll_fd, events, &spin);
             if (num_events == -1) {
                 if (errno == EINTR) continue;
                 // Handle error
@@ -119,114 +490,1303 @@ namespace snow {
             }
 
             for (int i = 0; i < num_events; ++i) {
-                if (events[i].data.fd == sock_fd) {
-                    // New connection
-                    struct sockaddr_in client_addr;
-                    socklen_t client_addr_len = sizeof(client_addr);
-                    int client_fd;
-                    while ((client_fd = accept(sock_fd, (struct sockaddr*)&client_addr, &client_addr_len)) > 0) {
-                        SetNonBlocking(client_fd);
-
-                        // Allocate an EventData for the new client and add to epoll
-                        // Note: EventData and EvenData are typos in the original header.
-                        // Assuming EventData is the correct one.
-                        EventData* event_data = new EventData();
-                        event_data->fd = client_fd;
-                        epoll_event new_event;
-                        new_event.events = EPOLLIN | EPOLLET;
-                        new_event.data.ptr = event_data;
-
-                        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &new_event) == -1) {
-                            delete event_data;
-                            close(client_fd);
-                        }
-                    }
-                    if (client_fd == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-                        // Handle accept error
-                    }
+                if (events[i].data.u64 & kCompletionTag) {
+                    // Responses finished by workers since the last wakeup
+                    WriteCompletions(epoll_fd);
+                } else if (events[i].data.u64 & kListenerTag) {
+                    AcceptConnections(epoll_fd, reinterpret_cast<Listener*>(events[i].data.u64 & ~kListenerTag));
+                } else if (events[i].data.u64 & kWatcherTag) {
+                    // Some other component's fd, e.g. an HttpClient connection
+                    reinterpret_cast<IoWatcher*>(events[i].data.u64 & ~kWatcherTag)->OnEvents(events[i].events);
                 } else {
                     // Data on existing connection
                     EventData* event_data = static_cast<EventData*>(events[i].data.ptr);
-                    thread_pool_.enqueue([this, epoll_fd, event_data, events_i = events[i].events]() {
-                        HandleEpollEvent(epoll_fd, event_data, events_i);
-                    });
+                    if (event_data->closed) {
+                        // Closed earlier in this batch, e.g. by a Broadcast to its channel
+                        continue;
+                    }
+
+                    // Admission control runs before anything is parsed or queued, so an
+                    // overloaded server refuses work at the cost of one write.
+                    // A connection carries one request and is charged for it once: later
+                    // reads of the request, upload body data and anything read while
+                    // parked on an event stream are not new requests. TLS connections are
+                    // admitted once their handshake is done.
+                    bool handshaking = event_data->tls && !event_data->tls->established();
+                    if ((events[i].events & EPOLLIN) && !event_data->admitted && !handshaking &&
+                        !AdmitRequest(epoll_fd, event_data)) {
+                        continue;
+                    }
+                    HandleEpollEvent(epoll_fd, event_data, events[i].events);
                 }
             }
+            FreeClosedConnections();
+        }
+        FreeClosedConnections();
+    }
+
+    void HttpServer::FreeClosedConnections() {
+        for (EventData* event : closed_) {
+            delete event;
+        }
+        closed_.clear();
+    }
+
+    void HttpServer::AcceptConnections(int epoll_fd, Listener* listener) {
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_fd;
+        while ((client_fd = accept(listener->fd, (struct sockaddr*)&client_addr, &client_addr_len)) > 0) {
+            // Connections carry one request each, so the sampling decision
+            // for the request is made here.
+            std::uint64_t trace_id = Tracer::StartRequest();
+            TraceSpan span("accept", trace_id);
+            SetNonBlocking(client_fd);
+
+            // Allocate an EventData for the new client and add to epoll
+            EventData* event_data = new EventData();
+            event_data->fd = client_fd;
+            // Unix socket peers have no address; they all share one admission key.
+            event_data->client_key = AdmissionController::ClientKey(
+                    (struct sockaddr*)&client_addr, client_addr_len);
+            if (client_addr.ss_family == AF_INET6) {
+                memcpy(event_data->peer_addr.data(), &reinterpret_cast<sockaddr_in6*>(&client_addr)->sin6_addr,
+                       event_data->peer_addr.size());
+            } else if (client_addr.ss_family == AF_INET) {
+                // Stored IPv4-mapped, so one field holds either family
+                event_data->peer_addr[10] = event_data->peer_addr[11] = 0xff;
+                memcpy(&event_data->peer_addr[12], &reinterpret_cast<sockaddr_in*>(&client_addr)->sin_addr, 4);
+            }
+            event_data->trace_id = trace_id;
+            event_data->accepted_ns = Tracer::Now();
+            if (listener->tls) {
+                // The handshake is driven by the connection's events like everything else
+                event_data->tls = listener->tls->Accept(client_fd);
+            }
+            epoll_event new_event;
+            new_event.events = EPOLLIN | kArmFlags;
+            new_event.data.ptr = event_data;
+
+            if ((listener->tls && !event_data->tls) ||
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &new_event) == -1) {
+                delete event_data;
+                close(client_fd);
+            }
+            client_addr_len = sizeof(client_addr);
+        }
+        if (client_fd == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            // Handle accept error
+        }
+    }
+
+    // Spin-then-block: poll without sleeping for up to *spin, which keeps the loop
+    // thread on its CPU and skips the wakeup latency when the next event comes soon.
+    // The window grows while spinning pays off and shrinks while it does not.
+    int HttpServer::WaitForEvents(int epoll_fd, epoll_event* events, std::chrono::microseconds* spin) {
+        std::chrono::microseconds limit = spin_limit_;
+        if (limit.count() > 0) {
+            auto deadline = std::chrono::steady_clock::now() + *spin;
+            do {
+                int num_events = epoll_wait(epoll_fd, events, kMaxEvents, 0);
+                if (num_events != 0) {
+                    *spin = std::min(*spin * 2, limit);
+                    return num_events;
+                }
+            } while (std::chrono::steady_clock::now() < deadline && running_);
+            *spin = std::max(*spin / 2, std::min(kMinSpin, limit));
+        }
+        return epoll_wait(epoll_fd, events, kMaxEvents, -1);
+    }
+
+    void HttpServer::RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
+                                                const HttpRequestHandler_t &callback, RouteOptions options) {
+        Route route;
+        route.handler = callback;
+        route.options = options;
+        AddRoute(path, method, std::move(route));
+    }
+
+    void HttpServer::RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
+                                                const CoroHttpRequestHandler_t &callback, RouteOptions options) {
+        Route route;
+        route.coro_handler = callback;
+        route.options = options;
+        AddRoute(path, method, std::move(route));
+    }
+
+    void HttpServer::RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
+                                                const ResponseWriterHandler_t &callback, RouteOptions options) {
+        Route route;
+        route.writer_handler = callback;
+        route.options = options;
+        AddRoute(path, method, std::move(route));
+    }
+
+    void HttpServer::RegisterUploadHandler(const std::string &path, HttpMethod method,
+                                           const UploadSinkFactory_t &open_sink, const UploadHandler_t &callback,
+                                           RouteOptions options) {
+        Route route;
+        route.upload_sink = open_sink;
+        route.upload_handler = callback;
+        route.options = options;
+        AddRoute(path, method, std::move(route));
+    }
+
+    void HttpServer::RegisterStaticResponse(const std::string &path, HttpMethod method, HttpResponse response) {
+        if (response.getStatusCode() == HttpStatusCode::Ok) {
+            response.setHeader("Accept-Ranges", "bytes");
         }
-        close(epoll_fd);
+        response.setHeader("Connection", "close");
+        Route route;
+        route.static_output = HttpResponseToString(response, method != HttpMethod::HEAD);
+        route.static_response = std::make_shared<const HttpResponse>(std::move(response));
+        route.options.policy = ExecutionPolicy::kInline;
+        AddRoute(path, method, std::move(route));
     }
 
+    void HttpServer::RegisterEventStream(const std::string &path, EventChannel &channel, EventStreamMode mode) {
+        channel.server_ = this;
+        if (mode == EventStreamMode::kLongPoll) {
+            channel.has_long_poll_.store(true, std::memory_order_relaxed);
+        }
+        if (std::find(channels_.begin(), channels_.end(), &channel) == channels_.end()) {
+            channels_.push_back(&channel);
+        }
+        Route route;
+        route.channel = &channel;
+        route.stream_mode = mode;
+        route.options.policy = ExecutionPolicy::kInline;
+        AddRoute(path, HttpMethod::GET, std::move(route));
+    }
+
+    void HttpServer::ServeStaticFiles(const std::string &url_prefix, const std::string &directory) {
+        std::string prefix = url_prefix;
+        if (prefix.empty() || prefix.back() != '/') {
+            prefix += '/';
+        }
+        static_dirs_.emplace_back(std::move(prefix), directory);
+    }
+
+    void HttpServer::AddRoute(const std::string &path, HttpMethod method, Route route) {
+        if (route.options.policy == ExecutionPolicy::kDedicatedPool && !dedicated_pool_) {
+            // These handlers are expected to block, which the pool compensates for with
+            // extra threads while keeping kDedicatedPoolSize of them runnable.
+            PoolSizing sizing;
+            sizing.min_threads = sizing.max_threads = kDedicatedPoolSize;
+            dedicated_pool_ = std::make_unique<ThreadPool>(sizing);
+        }
+        // Routes are matched against normalized request paths, so register them the same way.
+        std::string normalized_path = path;
+        if (UriNormalizer::NeedsNormalization(path)) {
+            UriNormalizer::NormalizePath(path, &normalized_path);
+        }
+        routes_[normalized_path][method] = std::move(route);
+    }
+
+    // Runs on the event loop thread for every event on a connection, and is where a
+    // connection's state decides what happens next. The event disarmed the fd, so the
+    // loop owns the connection now; each path either closes it, re-arms the fd through
+    // Arm, or hands it to a worker that returns it through the completion queue once
+    // its response is ready. Nothing can touch a connection while a worker has it.
+    //
+    // Reads happen here so the route, and with it the execution policy, is known
+    // before deciding whether to hand the request off.
     void HttpServer::HandleEpollEvent(int epoll_fd, EventData* event, std::uint32_t events) {
+        if (event->tls && !event->tls->established()) {
+            ContinueHandshake(epoll_fd, event);
+        } else if (event->subscription && event->subscription->channel) {
+            ContinueSubscription(epoll_fd, event, events);
+        } else if ((events & EPOLLERR) && event->zerocopy_sends != event->zerocopy_acked) {
+            // MSG_ZEROCOPY completions arrive on the error queue, only while writing;
+            // WriteResponse closes once the last one is in.
+            ReapZeroCopy(event);
+            WriteResponse(epoll_fd, event);
+        } else if (event->upload) {
+            // The rest of an upload body goes straight to its sink. The event is from
+            // the socket, or from the sink once it has room again after kSinkBlocked.
+            ContinueUpload(epoll_fd, event, PumpUpload(event));
+        } else if (events & EPOLLIN) {
+            ReadRequest(epoll_fd, event);
+        } else if (events & EPOLLOUT) {
+            WriteResponse(epoll_fd, event);
+        } else {
+            // EPOLLHUP or EPOLLERR alone; nothing will arm the fd again
+            CloseConnection(epoll_fd, event);
+        }
+    }
+
+    // Reads until the request is complete, the buffer is full or the socket has no
+    // more data. A request split across segments is picked up where it stopped on
+    // the next EPOLLIN; edge-triggered epoll would not report the leftover otherwise.
+    void HttpServer::ReadRequest(int epoll_fd, EventData* event) {
+        // Into a buffer borrowed for as long as the request takes
+        if (!event->buffer) {
+            event->buffer = read_buffers_.Acquire();
+        }
+        ssize_t length = 0;
+        {
+            TraceSpan span("read", event->trace_id);
+            while (event->length < kMaxBufferSize) {
+                length = Receive(event, event->buffer + event->length, kMaxBufferSize - event->length);
+                if (length > 0) {
+                    event->length += static_cast<size_t>(length);
+                    if (RequestComplete(std::string_view(event->buffer, event->length))) {
+                        break;
+                    }
+                } else if (length < 0 && errno == EINTR) {
+                    continue;
+                } else {
+                    break;
+                }
+            }
+        }
+        if (length > 0) {
+            // Complete, or as much as the buffer holds: an upload streams the rest of
+            // its body, anything else is answered from what is here
+            DispatchRequest(epoll_fd, event);
+        } else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The rest is still on its way; wait without a buffer if nothing came yet
+            if (event->length == 0) {
+                ReleaseReadBuffer(event);
+            }
+            Arm(epoll_fd, event, EPOLLIN);
+        } else {
+            // End of file or error, close connection
+            CloseConnection(epoll_fd, event);
+        }
+    }
+
+    void HttpServer::ContinueHandshake(int epoll_fd, EventData* event) {
+        TlsConnection::HandshakeStatus status;
+        {
+            TraceSpan span("handshake", event->trace_id);
+            status = event->tls->Handshake();
+        }
+        switch (status) {
+            case TlsConnection::HandshakeStatus::kWantRead:
+                Arm(epoll_fd, event, EPOLLIN);
+                return;
+            case TlsConnection::HandshakeStatus::kWantWrite:
+                Arm(epoll_fd, event, EPOLLOUT);
+                return;
+            case TlsConnection::HandshakeStatus::kFailed:
+                CloseConnection(epoll_fd, event);
+                return;
+            case TlsConnection::HandshakeStatus::kDone:
+                break;
+        }
+        // The request usually arrives in the same flight as the client's Finished and
+        // may already sit in OpenSSL's buffer, where epoll cannot see it, so it is read
+        // right away; ReadRequest arms the fd if it is not all there yet.
+        if (AdmitRequest(epoll_fd, event)) {
+            HandleEpollEvent(epoll_fd, event, EPOLLIN);
+        }
+    }
+
+    bool HttpServer::AdmitRequest(int epoll_fd, EventData* event) {
+        AdmissionVerdict verdict;
+        {
+            TraceSpan span("admission", event->trace_id);
+            verdict = admission_.Admit(event->client_key, thread_pool_.pending(), thread_pool_.queue_wait());
+        }
+        if (verdict != AdmissionVerdict::kAdmit) {
+            RejectConnection(epoll_fd, event, verdict);
+            return false;
+        }
+        event->admitted = true;
+        return true;
+    }
+
+    void HttpServer::DispatchRequest(int epoll_fd, EventData* event) {
+        const Route* route = FindRoute(std::string_view(event->buffer, event->length));
+        if (route && route->upload_handler) {
+            StartUpload(epoll_fd, event, route);
+            return;
+        }
+        if (route && route->static_response) {
+            ServeStaticResponse(epoll_fd, event, route);
+            return;
+        }
+        if (route && route->channel) {
+            Subscribe(epoll_fd, event, route);
+            return;
+        }
+        if (!route && !static_dirs_.empty() && ServeStaticFile(epoll_fd, event)) {
+            return;
+        }
+        RunHandler(epoll_fd, event, route, [this, event, route]() {
+            return HandleHttpData(*event, event, route);
+        });
+    }
+
+    // Runs work according to the route's execution policy. work returns true when
+    // event->output holds a response that is ready to be written.
+    void HttpServer::RunHandler(int epoll_fd, EventData* event, const Route* route, std::function<bool()> work,
+                                std::function<void()> on_expired) {
+        // Requests without a route only produce an error page, which is cheap enough to
+        // build on the loop itself.
+        ExecutionPolicy policy = route ? route->options.policy : ExecutionPolicy::kInline;
+        if (policy == ExecutionPolicy::kInline) {
+            if (work()) {
+                WriteResponse(epoll_fd, event);
+            }
+            return;
+        }
+
+        // Offloaded handlers leave the write to the loop: once the response is ready the
+        // worker pushes the connection onto the completion queue, and the loop writes it
+        // along with whatever else completed in the meantime. Workers never touch epoll.
+        ThreadPool& pool = policy == ExecutionPolicy::kDedicatedPool ? *dedicated_pool_ : thread_pool_;
+        ThreadPool::Clock::time_point deadline = ThreadPool::kNoDeadline;
+        if (route->options.deadline.count() > 0) {
+            deadline = ThreadPool::Clock::now() + route->options.deadline;
+        }
+        std::uint64_t queued_ns = event->trace_id ? Tracer::Now() : 0;
+        pool.submit(route->options.priority, deadline, [this, event, queued_ns, work = std::move(work)]() {
+            if (event->trace_id) {
+                Tracer::Record("pool_queue", event->trace_id, queued_ns, Tracer::Now());
+            }
+            if (work()) {
+                if (event->trace_id) event->ready_ns = Tracer::Now();
+                completions_->Push(event);
+            }
+        }, [this, event, on_expired = std::move(on_expired)]() {
+            if (on_expired) on_expired();
+            // Expired in the queue: answer with the same 503 the admission check uses.
+            event->output = admission_.RejectResponse(AdmissionVerdict::kOverloaded);
+            event->cursor = 0;
+            event->status = static_cast<std::uint16_t>(HttpStatusCode::ServiceUnvailable);
+            completions_->Push(event);
+        });
+    }
+
+    // Runs on the event loop when the first read of an upload route arrives. Only the
+    // headers are parsed; the body is handed to an UploadSink.
+    void HttpServer::StartUpload(int epoll_fd, EventData* event, const Route* route) {
+        auto reply = [this, epoll_fd, event](HttpStatusCode code, const char* html) {
+            HttpResponse response;
+            response.setStatusCode(code);
+            response.setContent(html);
+            SetResponse(event, response);
+            WriteResponse(epoll_fd, event);
+        };
+
+        // Like any other request, the headers have to arrive in the first read
+        std::string_view data(event->buffer, event->length);
+        size_t head_end = data.find("\r\n\r\n");
+        if (head_end == std::string_view::npos) {
+            reply(HttpStatusCode::BadRequest, "<html><body><h1>400 Bad Request</h1></body></html>");
+            return;
+        }
+        std::string_view head = data.substr(0, head_end + 4);
+
+        HttpRequest request;
+        try {
+            request = StringToHttpRequest(head);
+        } catch (const std::invalid_argument&) {
+            reply(HttpStatusCode::BadRequest, "<html><body><h1>400 Bad Request</h1></body></html>");
+            return;
+        } catch (const std::logic_error&) {
+            reply(HttpStatusCode::HttpVersionNotSupported,
+                  "<html><body><h1>505 HTTP Version Not Supported</h1></body></html>");
+            return;
+        }
+
+        // Framing comes from the raw headers: parsing an empty body rewrote Content-Length.
+        std::string_view transfer_encoding = FindHeaderValue(head, "Transfer-Encoding");
+        std::string_view content_length = FindHeaderValue(head, "Content-Length");
+        bool chunked = !transfer_encoding.empty();
+        size_t length = 0;
+        if (chunked) {
+            // Without chunked last the body has no end but the connection's (RFC 7230 3.3.3)
+            if (!FinalCodingIsChunked(transfer_encoding)) {
+                reply(HttpStatusCode::BadRequest, "<html><body><h1>400 Bad Request</h1></body></html>");
+                return;
+            }
+            request.removeHeader("Content-Length");
+        } else {
+            if (content_length.empty()) {
+                reply(HttpStatusCode::LengthRequired, "<html><body><h1>411 Length Required</h1></body></html>");
+                return;
+            }
+            auto [end, error] = std::from_chars(content_length.data(), content_length.data() + content_length.size(),
+                                                length);
+            if (error != std::errc() || end != content_length.data() + content_length.size()) {
+                reply(HttpStatusCode::BadRequest, "<html><body><h1>400 Bad Request</h1></body></html>");
+                return;
+            }
+            request.setHeader("Content-Length", content_length);
+        }
+
+        // 100-continue is the only expectation defined (RFC 7231 5.1.1)
+        std::string_view expect = FindHeaderValue(head, "Expect");
+        if (!expect.empty() && !EqualsIgnoreCase(expect, "100-continue")) {
+            reply(HttpStatusCode::ExpectationFailed, "<html><body><h1>417 Expectation Failed</h1></body></html>");
+            return;
+        }
+
+        int sink_fd = route->upload_sink(request);
+        if (sink_fd < 0) {
+            reply(HttpStatusCode::InternalServerError,
+                  "<html><body><h1>500 Internal Server Error</h1></body></html>");
+            return;
+        }
+        event->upload = std::make_unique<UploadSink>(std::move(request), sink_fd, chunked, length);
+        event->upload_route = route;
+        if (!event->upload->Open()) {
+            ContinueUpload(epoll_fd, event, UploadSink::Status::kSinkFailed);
+            return;
+        }
+
+        std::string_view body = data.substr(head.size());
+        if (body.empty() && !expect.empty()) {
+            // The client waits for this before sending a large body. The socket buffer
+            // is empty at this point, so the short write cannot block.
+            static constexpr std::string_view kContinue = "HTTP/1.1 100 Continue\r\n\r\n";
+            Send(event, kContinue.data(), kContinue.size());
+        }
+        UploadSink::Status status = event->upload->Consume(body);
+        // The rest of the body bypasses the read buffer
+        ReleaseReadBuffer(event);
+        if (status == UploadSink::Status::kNeedMore) {
+            status = PumpUpload(event);
+        }
+        ContinueUpload(epoll_fd, event, status);
+    }
+
+    UploadSink::Status HttpServer::PumpUpload(EventData* event) {
+        if (!event->tls) {
+            return event->upload->Pump(event->fd);
+        }
+        // Records are decrypted by OpenSSL, so a TLS body reaches the sink through a
+        // user-space buffer instead of splice.
+        UploadSink::Status status = event->upload->Flush();
+        if (status != UploadSink::Status::kNeedMore) {
+            return status;
+        }
+        char buffer[16 * 1024];
+        size_t budget = UploadSink::kMaxBytesPerPump;
+        while (true) {
+            // Bytes OpenSSL already decrypted are invisible to epoll, so the budget only
+            // ends the pump once they are taken.
+            if (budget == 0 && !event->tls->has_pending()) {
+                return UploadSink::Status::kNeedMore;
+            }
+            ssize_t length = event->tls->Read(buffer, sizeof(buffer));
+            if (length > 0) {
+                budget -= std::min(budget, static_cast<size_t>(length));
+                status = event->upload->Consume(std::string_view(buffer, static_cast<size_t>(length)));
+                if (status != UploadSink::Status::kNeedMore) {
+                    return status;
+                }
+                continue;
+            }
+            if (length < 0 && errno == EINTR) continue;
+            if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return UploadSink::Status::kNeedMore;
+            }
+            return UploadSink::Status::kDisconnected;
+        }
+    }
+
+    namespace {
+        std::string_view ContentTypeFor(std::string_view path) {
+            static constexpr std::pair<std::string_view, std::string_view> kTypes[] = {
+                    {".html", "text/html; charset=utf-8"},
+                    {".htm",  "text/html; charset=utf-8"},
+                    {".css",  "text/css; charset=utf-8"},
+                    {".js",   "text/javascript; charset=utf-8"},
+                    {".json", "application/json"},
+                    {".txt",  "text/plain; charset=utf-8"},
+                    {".svg",  "image/svg+xml"},
+                    {".png",  "image/png"},
+                    {".jpg",  "image/jpeg"},
+                    {".jpeg", "image/jpeg"},
+                    {".gif",  "image/gif"},
+                    {".webp", "image/webp"},
+                    {".mp4",  "video/mp4"},
+                    {".webm", "video/webm"},
+                    {".mp3",  "audio/mpeg"},
+                    {".pdf",  "application/pdf"},
+                    {".wasm", "application/wasm"},
+            };
+            size_t dot = path.rfind('.');
+            if (dot != std::string_view::npos && path.find('/', dot) == std::string_view::npos) {
+                std::string_view extension = path.substr(dot);
+                for (const auto &type : kTypes) {
+                    if (type.first == extension) return type.second;
+                }
+            }
+            return "application/octet-stream";
+        }
+
+        std::string HttpDate(time_t time) {
+            tm parts;
+            gmtime_r(&time, &parts);
+            char buffer[64];
+            size_t length = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+            return std::string(buffer, length);
+        }
+
+        // Strong validator built from size and modification time, so If-Range can use it.
+        std::string MakeEtag(const struct stat &info) {
+            char buffer[64];
+            int length = snprintf(buffer, sizeof(buffer), "\"%llx-%llx\"",
+                                  static_cast<unsigned long long>(info.st_size),
+                                  static_cast<unsigned long long>(info.st_mtim.tv_sec) * 1000000000ull +
+                                  static_cast<unsigned long long>(info.st_mtim.tv_nsec));
+            return std::string(buffer, static_cast<size_t>(length));
+        }
+    } // namespace
+
+    // Runs on the event loop for requests that matched no route. Returns false when the
+    // request is not for a static directory, leaving it to the normal 404/405 path.
+    bool HttpServer::ServeStaticFile(int epoll_fd, EventData* event) {
+        HttpRequest request;
+        try {
+            request = StringToHttpRequest(std::string_view(event->buffer, event->length));
+        } catch (const std::logic_error&) {
+            return false;
+        }
+        HttpMethod method = request.getMethod();
+        if (method != HttpMethod::GET && method != HttpMethod::HEAD) {
+            return false;
+        }
+        // The path is already normalized, so no "." or ".." segments are left in it.
+        std::string path(request.getUri().getPath());
+        const std::pair<std::string, std::string>* dir = nullptr;
+        for (const auto& candidate : static_dirs_) {
+            if (path.compare(0, candidate.first.size(), candidate.first) == 0) {
+                dir = &candidate;
+                break;
+            }
+        }
+        if (!dir) {
+            return false;
+        }
+        // Normalization keeps escapes of reserved and non-ASCII bytes, so the name on disk
+        // is only known after decoding. An escaped '/' or NUL would change which file the
+        // path names rather than spell a character of it, so those are refused.
+        HttpResponse response;
+        std::string relative;
+        if (!UriNormalizer::PercentDecode(std::string_view(path).substr(dir->first.size()), &relative) ||
+            relative.find('\0') != std::string::npos ||
+            std::count(relative.begin(), relative.end(), '/') !=
+                    std::count(path.begin() + static_cast<std::ptrdiff_t>(dir->first.size()), path.end(), '/')) {
+            response.setStatusCode(HttpStatusCode::BadRequest);
+            response.setContent("<html><body><h1>400 Bad Request</h1></body></html>");
+            SetResponse(event, response);
+            WriteResponse(epoll_fd, event);
+            return true;
+        }
+        std::string file_path = dir->second + "/" + relative;
+        if (file_path.back() == '/') {
+            file_path += "index.html";
+        }
+
+        int file_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (file_fd == -1 || fstat(file_fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+            if (file_fd != -1) close(file_fd);
+            response.setStatusCode(HttpStatusCode::NotFound);
+            response.setContent("<html><body><h1>404 Not Found</h1></body></html>");
+            SetResponse(event, response);
+            WriteResponse(epoll_fd, event);
+            return true;
+        }
+
+        std::uint64_t size = static_cast<std::uint64_t>(info.st_size);
+        std::string etag = MakeEtag(info);
+        std::string last_modified = HttpDate(info.st_mtim.tv_sec);
+        std::string_view content_type = ContentTypeFor(file_path);
+        response.setHeader("Accept-Ranges", "bytes");
+        response.setHeader("ETag", etag);
+        response.setHeader("Last-Modified", last_modified);
+
+        RangePlan plan = PlanRanges(request, size, etag, last_modified);
+        std::uint64_t content_length = 0;
+        std::string first_part_header;
+        std::vector<FileSpan> spans;
+        if (plan.status == HttpStatusCode::RangeNotSatisfiable) {
+            response.setHeader("Content-Range", UnsatisfiedContentRange(size));
+        } else if (plan.status == HttpStatusCode::PartialContent && plan.ranges.size() == 1) {
+            const ByteRange& range = plan.ranges.front();
+            response.setHeader("Content-Type", content_type);
+            response.setHeader("Content-Range", ContentRange(range, size));
+            spans.push_back(FileSpan{static_cast<off_t>(range.first), range.length, {}});
+            content_length = range.length;
+        } else if (plan.status == HttpStatusCode::PartialContent) {
+            // Each range is preceded by its part header; the header of the first one goes
+            // out with the response headers and every later one rides on the span before.
+            MultipartRanges multipart(content_type, size);
+            response.setHeader("Content-Type", multipart.ContentType());
+            content_length = multipart.ContentLength(plan.ranges);
+            first_part_header = multipart.PartHeader(plan.ranges.front());
+            for (size_t i = 0; i < plan.ranges.size(); ++i) {
+                const ByteRange& range = plan.ranges[i];
+                std::string suffix = i + 1 < plan.ranges.size() ? multipart.PartHeader(plan.ranges[i + 1])
+                                                                : multipart.Closing();
+                spans.push_back(FileSpan{static_cast<off_t>(range.first), range.length, std::move(suffix)});
+            }
+        } else {
+            response.setHeader("Content-Type", content_type);
+            if (size > 0) {
+                spans.push_back(FileSpan{0, size, {}});
+            }
+            content_length = size;
+        }
+        response.setStatusCode(plan.status);
+        response.setHeader("Content-Length", std::to_string(content_length));
+
+        SetResponse(event, response, false);
+        if (method == HttpMethod::HEAD || spans.empty()) {
+            close(file_fd);
+        } else {
+            event->output += first_part_header;
+            event->file_fd = file_fd;
+            event->file_spans = std::move(spans);
+            event->span_index = 0;
+        }
+        WriteResponse(epoll_fd, event);
+        return true;
+    }
+
+    // Runs on the event loop. The common case only points the connection at the bytes
+    // serialized at registration; nothing is parsed, built or copied.
+    void HttpServer::ServeStaticResponse(int epoll_fd, EventData* event, const Route* route) {
+        std::string_view head(event->buffer, event->length);
+        size_t head_end = head.find("\r\n\r\n");
+        if (head_end != std::string_view::npos && !FindHeaderValue(head.substr(0, head_end + 2), "Range").empty()) {
+            // A range of the body has to be cut out for this request
+            HttpResponse response = *route->static_response;
+            bool send_content = true;
+            try {
+                HttpRequest request = StringToHttpRequest(head);
+                ApplyRanges(request, &response);
+                send_content = request.getMethod() != HttpMethod::HEAD;
+            } catch (const std::logic_error&) {
+                // Malformed headers: the full response is still a valid answer
+            }
+            SetResponse(event, response, send_content);
+            WriteResponse(epoll_fd, event);
+            return;
+        }
+        event->shared_output = &route->static_output;
+        event->cursor = 0;
+        event->status = static_cast<std::uint16_t>(route->static_response->getStatusCode());
+        WriteResponse(epoll_fd, event);
+    }
+
+    // Runs on the event loop. The request itself is not parsed: the route says
+    // everything there is to know, and the connection is parked until the channel
+    // has something for it.
+    void HttpServer::Subscribe(int epoll_fd, EventData* event, const Route* route) {
+        EventChannel* channel = route->channel;
+        event->subscription = std::make_unique<Subscription>();
+        Subscription& subscription = *event->subscription;
+        subscription.channel = channel;
+        subscription.index = channel->subscribers_.size();
+        subscription.long_poll = route->stream_mode == EventStreamMode::kLongPoll;
+        channel->subscribers_.push_back(event);
+        channel->subscriber_count_.fetch_add(1, std::memory_order_relaxed);
+        // Subscribers may stay for hours; they do not keep the request around.
+        ReleaseReadBuffer(event);
+        if (subscription.long_poll) {
+            // Nothing to write until Broadcast; EPOLLIN tells when a client gives up
+            WriteStream(epoll_fd, event);
+            return;
+        }
+        // Events are small and latency is the point, so do not let Nagle hold one back
+        // behind the previous one's ACK. Fails harmlessly on Unix sockets.
+        int on = 1;
+        setsockopt(event->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        event->shared_output = &kEventStreamHeaders;
+        event->cursor = 0;
+        event->status = static_cast<std::uint16_t>(HttpStatusCode::Ok);
+        WriteStream(epoll_fd, event);
+    }
+
+    void HttpServer::ContinueSubscription(int epoll_fd, EventData* event, std::uint32_t events) {
+        event->subscription->armed = 0;     // Disarmed by this event
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            CloseConnection(epoll_fd, event);
+            return;
+        }
         if (events & EPOLLIN) {
-            // Read data
-            event->length = read(event->fd, event->buffer, kMaxBufferSize);
-            if (event->length > 0) {
-                EventData response_data;
-                HandleHttpData(*event, &response_data);
-
-                // Set up epoll to monitor for write events
-                epoll_event write_event;
-                write_event.events = EPOLLOUT | EPOLLET;
-                write_event.data.ptr = event;
-                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, event->fd, &write_event);
+            // A subscriber has nothing more to say after its request; reading only tells
+            // whether it is still there.
+            char discard[kMaxBufferSize];
+            ssize_t length;
+            while ((length = Receive(event, discard, sizeof(discard))) > 0) {
+            }
+            if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                CloseConnection(epoll_fd, event);
+                return;
+            }
+        }
+        WriteStream(epoll_fd, event);
+    }
+
+    void HttpServer::WriteStream(int epoll_fd, EventData* event) {
+        Subscription& subscription = *event->subscription;
+        while (true) {
+            // The response headers first, then the queued events in order
+            std::string_view pending;
+            if (event->cursor < event->Output().size()) {
+                pending = event->Output().substr(event->cursor);
+            } else if (!subscription.queue.empty()) {
+                pending = std::string_view(*subscription.queue.front()).substr(subscription.cursor);
             } else {
-                // End of file or error, close connection
-                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, event->fd, nullptr);
-                close(event->fd);
-                delete event;
+                break;
             }
-        } else if (events & EPOLLOUT) {
-            // Write data
-            size_t written = write(event->fd, event->buffer + event->cursor, event->length - event->cursor);
+            ssize_t written = Send(event, pending.data(), pending.size());
             if (written < 0) {
-                // Handle error
-                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, event->fd, nullptr);
-                close(event->fd);
-                delete event;
-            } else {
-                event->cursor += written;
-                if (event->cursor == event->length) {
-                    // All data written, close connection for now
-                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, event->fd, nullptr);
-                    close(event->fd);
-                    delete event;
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
                 }
+                CloseConnection(epoll_fd, event);
+                return;
+            }
+            event->bytes_sent += static_cast<size_t>(written);
+            if (event->cursor < event->Output().size()) {
+                event->cursor += static_cast<size_t>(written);
+            } else if ((subscription.cursor += static_cast<size_t>(written)) == subscription.queue.front()->size()) {
+                subscription.queue.pop_front();
+                subscription.cursor = 0;
             }
         }
+        // EPOLLOUT only while something is left, so a caught-up subscriber does not
+        // wake the loop for every ACK. EPOLLIN always, to notice the client leaving.
+        bool pending = event->cursor < event->Output().size() || !subscription.queue.empty();
+        std::uint32_t interest = pending ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        if (subscription.armed != interest) {
+            subscription.armed = interest;
+            Arm(epoll_fd, event, interest);
+        }
     }
 
-    void HttpServer::HandleHttpData(const EventData& request, EventData* response) {
-        HttpRequest http_request;
-        HttpParser parser;
-        parser.ParseRequest(request.buffer, request.length, &http_request);
+    void HttpServer::Unsubscribe(EventData* event) {
+        Subscription& subscription = *event->subscription;
+        std::vector<EventData*>& subscribers = subscription.channel->subscribers_;
+        // Swap with the last subscriber, so leaving is O(1) whatever the order
+        EventData* last = subscribers.back();
+        subscribers[subscription.index] = last;
+        last->subscription->index = subscription.index;
+        subscribers.pop_back();
+        subscription.channel->subscriber_count_.fetch_sub(1, std::memory_order_relaxed);
+        subscription.channel = nullptr;
+    }
 
-        HttpResponse http_response;
-        if (coro_request_handlers_.count(http_request.uri())) {
-            if (coro_request_handlers_[http_request.uri()].count(http_request.method())) {
-                // Found a coroutine handler
-                CoroTask task = coro_request_handlers_[http_request.uri()][http_request.method()](http_request);
-                task.resume();
-                while (!task.done()) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    task.resume();
-                }
-                http_response = task.get_response();
+    void HttpServer::Broadcast(EventChannel* channel, const std::shared_ptr<const std::string>& frame,
+                               const std::shared_ptr<const std::string>& long_poll, std::uint16_t long_poll_status) {
+        int epoll_fd = epoll_fd_;
+        std::vector<EventData*>& subscribers = channel->subscribers_;
+        // Backwards: a subscriber that leaves is replaced by the last one, which has
+        // already been served.
+        for (size_t i = subscribers.size(); i-- > 0;) {
+            EventData* event = subscribers[i];
+            Subscription& subscription = *event->subscription;
+            if (subscription.long_poll) {
+                if (!long_poll) continue;
+                Unsubscribe(event);
+                subscription.response = long_poll;
+                event->shared_output = subscription.response.get();
+                event->cursor = 0;
+                event->status = long_poll_status;
+                WriteResponse(epoll_fd, event);
+                continue;
             }
-        } else if (request_handlers_.count(http_request.uri())) {
-            if (request_handlers_[http_request.uri()].count(http_request.method())) {
-                // Found a regular synchronous handler
-                http_response = request_handlers_[http_request.uri()][http_request.method()](http_request);
+            if (subscription.queue.size() >= channel->options_.max_queued_events) {
+                // Too slow to keep up; it reconnects and resumes from Last-Event-ID
+                CloseConnection(epoll_fd, event);
+                continue;
+            }
+            subscription.queue.push_back(frame);
+            if (!(subscription.armed & EPOLLOUT)) {
+                WriteStream(epoll_fd, event);
+            }
+        }
+    }
+
+    void HttpServer::ContinueUpload(int epoll_fd, EventData* event, UploadSink::Status status) {
+        if (status == UploadSink::Status::kNeedMore) {
+            Arm(epoll_fd, event, EPOLLIN);
+            return;
+        }
+        if (status == UploadSink::Status::kSinkBlocked) {
+            // Park on the sink instead of the socket until it takes more. Its event
+            // carries the connection like the socket's, and HandleEpollEvent sends
+            // both back to PumpUpload. A sink epoll cannot watch never blocks anyway.
+            epoll_event sink_event;
+            sink_event.events = EPOLLOUT | kArmFlags;
+            sink_event.data.ptr = event;
+            if (epoll_ctl(epoll_fd, event->sink_watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                          event->upload->sink(), &sink_event) == 0) {
+                event->sink_watched = true;
+                return;
+            }
+            status = UploadSink::Status::kSinkFailed;
+        }
+        const Route* route = event->upload_route;
+        std::shared_ptr<UploadSink> upload(std::move(event->upload));
+        if (event->sink_watched) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upload->sink(), nullptr);
+            event->sink_watched = false;
+        }
+        upload->RestoreSink();
+
+        if (status == UploadSink::Status::kDone) {
+            RunHandler(epoll_fd, event, route, [event, route, upload]() {
+                try {
+                    HttpResponse response = route->upload_handler(upload->request(),
+                                                                  UploadResult{upload->sink(), upload->bytes(), true});
+                    SetResponse(event, response);
+                } catch (...) {
+                    HttpResponse error = InternalServerError();
+                    SetResponse(event, error);
+                }
+                return true;
+            }, [upload]() {
+                // The handler never runs, so nobody else will close the sink
+                close(upload->sink());
+            });
+            return;
+        }
+
+        // The body did not arrive in full. The handler still gets its fd back so it can
+        // close it and discard whatever was written.
+        route->upload_handler(upload->request(), UploadResult{upload->sink(), upload->bytes(), false});
+        if (status == UploadSink::Status::kDisconnected) {
+            CloseConnection(epoll_fd, event);
+            return;
+        }
+        HttpResponse response;
+        if (status == UploadSink::Status::kBadBody) {
+            response.setStatusCode(HttpStatusCode::BadRequest);
+            response.setContent("<html><body><h1>400 Bad Request</h1></body></html>");
+        } else {
+            response.setStatusCode(HttpStatusCode::InternalServerError);
+            response.setContent("<html><body><h1>500 Internal Server Error</h1></body></html>");
+        }
+        SetResponse(event, response);
+        WriteResponse(epoll_fd, event);
+    }
+
+    const Route* HttpServer::FindRoute(std::string_view request) const {
+        // Only the request line is looked at here; headers are parsed later by
+        // whichever thread runs the handler.
+        HttpMethod method;
+        UriView target;
+        if (!PeekRequestLine(request, &method, &target)) {
+            return nullptr;
+        }
+        auto path_it = routes_.end();
+        if (UriNormalizer::NeedsNormalization(target.path)) {
+            std::string normalized_path;
+            if (!UriNormalizer::NormalizePath(target.path, &normalized_path)) {
+                return nullptr;
             }
+            path_it = routes_.find(normalized_path);
         } else {
-            // No handler found
-            http_response = HttpResponse(404, "Not Found", "<html><body><h1>404 Not Found</h1></body></html>");
+            path_it = routes_.find(target.path);
+        }
+        if (path_it == routes_.end()) {
+            return nullptr;
+        }
+        auto method_it = path_it->second.find(method);
+        return method_it == path_it->second.end() ? nullptr : &method_it->second;
+    }
+
+    void HttpServer::WriteResponse(int epoll_fd, EventData* event) {
+        // The response is ready, so the request has been consumed; a slow reader on the
+        // other end does not keep the buffer.
+        ReleaseReadBuffer(event);
+        if (event->trace_id && event->ready_ns) {
+            // Time between a worker finishing and the loop picking the response up
+            Tracer::Record("write_wait", event->trace_id, event->ready_ns, Tracer::Now());
+            event->ready_ns = 0;
+        }
+        TraceSpan span("write", event->trace_id);
+        while (event->cursor < event->Output().size()) {
+            ssize_t written = SendOutput(event);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // Socket buffer is full, continue when the loop sees EPOLLOUT.
+                    Arm(epoll_fd, event, EPOLLOUT);
+                    return;
+                }
+                CloseConnection(epoll_fd, event);
+                return;
+            }
+            event->cursor += static_cast<size_t>(written);
+            event->bytes_sent += static_cast<size_t>(written);
+        }
+        // A static file body follows the headers straight from the page cache.
+        if (event->span_index < event->file_spans.size()) {
+            FileSpan& span = event->file_spans[event->span_index];
+            while (span.length > 0) {
+                ssize_t sent = event->tls ? event->tls->SendFile(event->file_fd, &span.offset, span.length)
+                                          : sendfile(event->fd, event->file_fd, &span.offset, span.length);
+                if (sent < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        Arm(epoll_fd, event, EPOLLOUT);
+                        return;
+                    }
+                    CloseConnection(epoll_fd, event);
+                    return;
+                }
+                if (sent == 0) {
+                    // The file was truncated after Content-Length went out
+                    CloseConnection(epoll_fd, event);
+                    return;
+                }
+                span.length -= static_cast<size_t>(sent);
+                event->bytes_sent += static_cast<size_t>(sent);
+            }
+            // Then the next part header or the closing boundary, like any other output
+            event->output = std::move(span.suffix);
+            event->cursor = 0;
+            ++event->span_index;
+            WriteResponse(epoll_fd, event);
+            return;
         }
+        if (event->zerocopy_sends != event->zerocopy_acked) {
+            ReapZeroCopy(event);
+            if (event->zerocopy_sends != event->zerocopy_acked) {
+                // The kernel still reads from output. Closing now would free it under the
+                // NIC, so wait for the remaining completions (EPOLLERR is always reported).
+                Arm(epoll_fd, event, 0);
+                return;
+            }
+        }
+        // All data written, close connection for now
+        CloseConnection(epoll_fd, event);
+    }
 
-        // Convert HttpResponse to raw data and copy to response buffer
-        std::string raw_response = http_response.ToString();
-        memcpy(response->buffer, raw_response.c_str(), raw_response.size());
-        response->length = raw_response.size();
-        response->fd = request.fd;
+    // Runs on the event loop after a completion wakeup. The connections are still
+    // disarmed, so each is written straight away; only those whose socket fills up
+    // are armed for EPOLLOUT.
+    void HttpServer::WriteCompletions(int epoll_fd) {
+        EventData* event = completions_->TakeAll();
+        while (event) {
+            // WriteResponse may free event
+            EventData* next = event->next_completed;
+            event->next_completed = nullptr;
+            WriteResponse(epoll_fd, event);
+            event = next;
+        }
+    }
+
+    // Writes the unsent part of event->output. Large dynamic bodies are sent with
+    // MSG_ZEROCOPY: the kernel pins the pages of output instead of copying them, and
+    // output stays untouched until every such send is reported complete. Static file
+    // responses replace output between spans, so they never take this path; sendfile
+    // already avoids the copy for them.
+    ssize_t HttpServer::SendOutput(EventData* event) {
+        std::string_view output = event->Output();
+        const char* data = output.data() + event->cursor;
+        size_t length = output.size() - event->cursor;
+        if (event->tls) {
+            // Kernel TLS rejects MSG_ZEROCOPY; it already encrypts from our buffer
+            // into its own, so the copy happens either way.
+            return event->tls->Write(data, length);
+        }
+        if (zerocopy_threshold_ > 0 && length >= zerocopy_threshold_ && event->file_spans.empty()) {
+            if (!event->zerocopy_tried) {
+                event->zerocopy_tried = true;
+                int on = 1;
+                event->zerocopy = setsockopt(event->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+            }
+            if (event->zerocopy) {
+                ssize_t sent = send(event->fd, data, length, MSG_ZEROCOPY | MSG_NOSIGNAL);
+                if (sent >= 0) {
+                    ++event->zerocopy_sends;
+                    return sent;
+                }
+                // ENOBUFS means the socket's optmem limit for pinned pages is reached;
+                // this chunk is simply copied.
+                if (errno != ENOBUFS) {
+                    return sent;
+                }
+            }
+        }
+        return send(event->fd, data, length, MSG_NOSIGNAL);
+    }
+
+    void HttpServer::ReapZeroCopy(EventData* event) {
+        while (true) {
+            char control[128];
+            msghdr message{};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if (recvmsg(event->fd, &message, MSG_ERRQUEUE) == -1) {
+                return;     // EAGAIN: nothing more queued
+            }
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+                if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                sock_extended_err error;
+                memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                // One notification covers the inclusive range of send ids [ee_info, ee_data]
+                event->zerocopy_acked += error.ee_data - error.ee_info + 1;
+                if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    // The kernel had to copy anyway (loopback, or a device without
+                    // scatter-gather): stop paying for notifications on this connection.
+                    event->zerocopy = false;
+                }
+            }
+        }
+    }
+
+    void HttpServer::CloseConnection(int epoll_fd, EventData* event) {
+        if (event->trace_id) {
+            Tracer::Record("request", event->trace_id, event->accepted_ns, Tracer::Now());
+        }
+        if (access_log_) {
+            LogAccess(event);
+        }
+        control_epoll_envent(epoll_fd, EPOLL_CTL_DEL, event->fd);
+        ReleaseReadBuffer(event);
+        if (event->subscription && event->subscription->channel) {
+            Unsubscribe(event);
+        }
+        if (event->file_fd != -1) {
+            close(event->file_fd);
+        }
+        if (event->tls) {
+            event->tls->Shutdown();
+        }
+        close(event->fd);
+        // The batch being processed may still hold an event for this connection, and
+        // handling one event can close another (Broadcast does), so it is freed by
+        // Listen once the batch is done.
+        event->closed = true;
+        closed_.push_back(event);
+    }
+
+    void HttpServer::RejectConnection(int epoll_fd, EventData* event, AdmissionVerdict verdict) {
+        // Drain what the client sent without looking at it: closing a socket with
+        // unread data makes the kernel send RST, which can discard our response.
+        // The drain is bounded, so a client that keeps streaming a body cannot hold
+        // the loop; what it sends after that may still reset the connection.
+        char discard[kMaxBufferSize];
+        for (int i = 0; i < kRejectDrainReads && Receive(event, discard, sizeof(discard)) > 0; ++i) {
+        }
+
+        // Best effort: the pre-serialized response is small enough for the socket buffer.
+        const std::string& response = admission_.RejectResponse(verdict);
+        ssize_t sent = Send(event, response.data(), response.size());
+        if (access_log_) {
+            // The request was never read into the buffer, so it is logged without its line
+            event->length = 0;
+            event->status = static_cast<std::uint16_t>(verdict == AdmissionVerdict::kRateLimited
+                                                       ? HttpStatusCode::TooManyRequests
+                                                       : HttpStatusCode::ServiceUnvailable);
+            event->bytes_sent = sent > 0 ? static_cast<std::uint64_t>(sent) : 0;
+            LogAccess(event);
+        }
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, event->fd, nullptr);
+        ReleaseReadBuffer(event);
+        if (event->tls) {
+            event->tls->Shutdown();
+        }
+        // The FIN follows the response, so a client that reads it before the reset sees
+        // the whole answer.
+        shutdown(event->fd, SHUT_WR);
+        close(event->fd);
+        delete event;
+    }
+
+    void HttpServer::ReleaseReadBuffer(EventData* event) {
+        if (!event->buffer) {
+            return;
+        }
+        if (access_log_ && event->length > 0) {
+            event->request_line = RequestLine(std::string_view(event->buffer, event->length));
+        }
+        read_buffers_.Release(event->buffer);
+        event->buffer = nullptr;
+    }
+
+    // Returns true when response->output is ready to be written. Coroutine handlers
+    // may finish later on another thread; HandleCoroutine queues the write for them.
+    bool HttpServer::HandleHttpData(const EventData& request, EventData* response, const Route* route) {
+        std::string_view raw_request(request.buffer, request.length);
+        if (route && route->coro_handler) {
+            try {
+                // A suspended coroutine outlives this call, so its request cannot live
+                // in the per-request arena. HandleCoroutine answers a throwing handler
+                // itself, so only parse errors land here.
+                HandleCoroutine(response, route, StringToHttpRequest(raw_request));
+                return false;
+            } catch (const std::logic_error&) {
+                // Malformed request, answered below like any other
+            }
+        }
+
+        // Everything the request and its response allocate comes from this arena and
+        // is released in one step when HandleHttpData returns.
+        //
+        // The catches at the end are for the parser: std::invalid_argument is a malformed
+        // request and any other std::logic_error an unsupported version. Handlers run
+        // under their own catch-all, so whatever they throw becomes a 500 and never
+        // reaches those, nor the worker thread or event loop that called us.
+        std::uint64_t trace_id = request.trace_id;
+        RequestArena arena;
+        HttpResponse http_response(arena.allocator());
+        try {
+            std::uint64_t parse_start = trace_id ? Tracer::Now() : 0;
+            HttpRequest http_request = StringToHttpRequest(raw_request, arena.allocator());
+            if (trace_id) {
+                Tracer::Record("parse", trace_id, parse_start, Tracer::Now());
+            }
+            if (route && route->writer_handler) {
+                // The handler serializes straight into the connection's output buffer
+                response->output.clear();
+                ResponseWriter writer(&response->output, kConnectionClose,
+                                      http_request.getMethod() != HttpMethod::HEAD);
+                try {
+                    TraceSpan span("handler", trace_id);
+                    route->writer_handler(http_request, writer);
+                    writer.Finish();
+                } catch (...) {
+                    // Whatever the handler wrote so far is replaced
+                    HttpResponse error = InternalServerError();
+                    SetResponse(response, error);
+                    return true;
+                }
+                response->shared_output = nullptr;
+                response->cursor = 0;
+                response->status = static_cast<std::uint16_t>(writer.status());
+                return true;
+            } else if (route && route->handler) {
+                // Found a regular synchronous handler. Its response is serialized where it
+                // is: moving it into the arena-backed http_response would copy every
+                // string, since pmr strings only move within one memory resource.
+                std::uint64_t handler_start = trace_id ? Tracer::Now() : 0;
+                try {
+                    HttpResponse handler_response = route->handler(http_request);
+                    if (trace_id) {
+                        Tracer::Record("handler", trace_id, handler_start, Tracer::Now());
+                    }
+                    TraceSpan span("serialize", trace_id);
+                    SetResponse(response, handler_response);
+                } catch (...) {
+                    HttpResponse error = InternalServerError();
+                    SetResponse(response, error);
+                }
+                return true;
+            } else if (routes_.count(http_request.getUri().getPath())) {
+                // The path exists but not for this method
+                http_response.setStatusCode(HttpStatusCode::MethodNotAllowed);
+                http_response.setContent("<html><body><h1>405 Method Not Allowed</h1></body></html>");
+            } else {
+                // No handler found
+                http_response.setStatusCode(HttpStatusCode::NotFound);
+                http_response.setContent("<html><body><h1>404 Not Found</h1></body></html>");
+            }
+        } catch (const std::invalid_argument&) {
+            http_response.setStatusCode(HttpStatusCode::BadRequest);
+            http_response.setContent("<html><body><h1>400 Bad Request</h1></body></html>");
+        } catch (const std::logic_error&) {
+            http_response.setStatusCode(HttpStatusCode::HttpVersionNotSupported);
+            http_response.setContent("<html><body><h1>505 HTTP Version Not Supported</h1></body></html>");
+        }
+
+        TraceSpan span("serialize", trace_id);
+        SetResponse(response, http_response);
+        return true;
+    }
+
+    // Serializes response into event->output for the loop to write. The connection is
+    // closed once it is written, which clients (HttpClient included) must be told so
+    // they do not reuse it.
+    void HttpServer::SetResponse(EventData* event, HttpResponse& response, bool send_content) {
+        response.setHeader("Connection", "close");
+        event->output = HttpResponseToString(response, send_content);
+        event->shared_output = nullptr;
+        event->cursor = 0;
+        event->status = static_cast<std::uint16_t>(response.getStatusCode());
+    }
+
+    // Runs on whichever thread closes the connection; AccessLog::Log only copies the
+    // record into that thread's buffer.
+    void HttpServer::LogAccess(const EventData* event) {
+        if (event->length == 0 && event->status == 0) {
+            return;     // Closed before sending anything, not a request
+        }
+        // Straight from the read buffer while the request still holds one
+        std::string_view line = event->buffer ? RequestLine(std::string_view(event->buffer, event->length))
+                                              : std::string_view(event->request_line);
+
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        AccessEntry entry;
+        entry.time_ns = static_cast<std::uint64_t>(now.tv_sec) * 1000000000ull +
+                        static_cast<std::uint64_t>(now.tv_nsec);
+        entry.duration_ns = Tracer::Now() - event->accepted_ns;
+        entry.bytes_sent = event->bytes_sent;
+        entry.peer_addr = event->peer_addr;
+        entry.status = event->status;
+        entry.request = line;
+        access_log_->Log(entry);
+    }
+
+    namespace {
+        // A coroutine handler in flight: the request it reads and the task itself.
+        // Deleted from the task's completion callback.
+        struct CoroContext {
+            explicit CoroContext(HttpRequest req) : request(std::move(req)) {}
+
+            HttpRequest request;
+            CoroTask task;
+        };
+    } // namespace
+
+    void HttpServer::HandleCoroutine(EventData* response, const Route* route, HttpRequest request) {
+        auto* context = new CoroContext(std::move(request));
+        try {
+            context->task = route->coro_handler(context->request);
+        } catch (...) {
+            // Thrown before the coroutine existed (e.g. by a plain function wrapped as
+            // a coroutine handler), so no task will report it
+            delete context;
+            HttpResponse error = InternalServerError();
+            SetResponse(response, error);
+            completions_->Push(response);
+            return;
+        }
+
+        // The coroutine may suspend on asynchronous I/O (for example an HttpClient
+        // call) and be resumed by the event loop, so its end, not this function's,
+        // is where the response gets handed to the loop for writing.
+        std::uint64_t started_ns = response->trace_id ? Tracer::Now() : 0;
+        context->task.set_on_complete([this, response, context, started_ns]() {
+            if (context->task.exception()) {
+                // The handler threw; the client still gets an answer
+                HttpResponse error = InternalServerError();
+                SetResponse(response, error);
+            } else {
+                SetResponse(response, context->task.get_response());
+            }
+            if (response->trace_id) {
+                // From first resume to completion, including any time spent suspended
+                response->ready_ns = Tracer::Now();
+                Tracer::Record("coroutine", response->trace_id, started_ns, response->ready_ns);
+            }
+            completions_->Push(response);
+            delete context;
+        });
+        context->task.resume();
     }
 
     HttpResponse HttpServer::HandleHttpRequest(const HttpRequest &request) {
@@ -242,9 +1802,17 @@ namespace snow {
         co_return HttpResponse(404, "Not Found", "Coro handler not implemented.");
     }
 
+    // The one place a connection's fd is re-armed. Only the loop calls it; workers
+    // hand connections back through the completion queue instead.
+    void HttpServer::Arm(int epoll_fd, EventData* event, std::uint32_t events) {
+        control_epoll_envent(epoll_fd, EPOLL_CTL_MOD, event->fd, events | kArmFlags, event);
+    }
+
     void HttpServer::control_epoll_envent(int epoll_fd, int op, int fd, std::uint32_t events, void *data) {
-        // This function is declared but not implemented.
-        // The epoll control logic is directly in Listen() and HandleEpollEvent().
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = data;
+        epoll_ctl(epoll_fd, op, fd, op == EPOLL_CTL_DEL ? nullptr : &event);
     }
 
-} // snow
\ No newline at end of file
+} // snow
@@ -9,17 +9,31 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <array>
 #include <chrono>
+#include <deque>
 #include <functional>
 #include <map>
+#include <memory>
 #include <random>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "http/http_message.h"
-#include "http/uri.h"
+#include "http/ResponseWriter.h"
+#include "http/Uri.h"
+#include "coroutines/coro_http_handler.h"
+#include "AccessLog.h"
+#include "AdmissionControl.h"
+#include "CompletionQueue.h"
+#include "ReadBufferPool.h"
 #include "ThreadPool.h"
+#include "ThreadTopology.h"
+#include "TlsContext.h"
+#include "Tracer.h"
+#include "UploadSink.h"
 
 
 namespace snow {
@@ -27,13 +41,102 @@ namespace snow {
     constexpr size_t
     kMaxBufferSize = 4096;
 
-    struct EvenData {
-        EventData() : fd(0), length(0), cursor(0), buffer() {}
+    struct Route;
+
+    class EventChannel;
+
+    //订阅了EventChannel的连接的状态，只在事件循环线程上访问
+    struct Subscription {
+        EventChannel *channel = nullptr;    //收到长轮询的响应或者断开之后为空
+        size_t index = 0;                   //在channel订阅者列表中的下标
+        bool long_poll = false;
+        //还没有写完的SSE事件，cursor是第一个事件已经写出的字节数
+        std::deque<std::shared_ptr<const std::string>> queue;
+        size_t cursor = 0;
+        std::uint32_t armed = 0;            //fd当前注册的事件，EPOLLONESHOT触发之后为0
+        std::shared_ptr<const std::string> response;    //长轮询收到的响应，shared_output指向它
+    };
+
+    //响应头之后用sendfile发出的一段文件，suffix在这段数据之后写出
+    //(multipart/byteranges中下一段的part header或者结束分隔行)
+    struct FileSpan {
+        off_t offset;
+        size_t length;
+        std::string suffix;
+    };
+
+    struct EventData {
+        EventData() : fd(0), client_key(0), length(0), cursor(0) {}
 
         int fd;
+        std::uint64_t client_key;   //对端地址生成的key，用于按客户端限流
+        bool admitted = false;      //准入控制已经放行了这个连接的请求(每个连接只有一个请求)
         size_t length;
-        size_t cursor;
-        char buffer[kMaxBufferSize];
+        size_t cursor;              //output中已经写出的字节数
+        //从事件循环的ReadBufferPool借来的kMaxBufferSize字节，只在读到请求到请求被处理完之间持有，
+        //空闲的连接没有读缓冲区
+        char *buffer = nullptr;
+        std::string request_line;   //归还buffer之前为访问日志截取的"METHOD target"
+        std::string output;         //序列化好的响应，由事件循环负责写出
+        //不为空时代替output写出，指向RegisterStaticResponse注册时序列化好的响应
+        const std::string *shared_output = nullptr;
+        //上传路由正在接收body时不为空，之后的EPOLLIN都交给它
+        std::unique_ptr<UploadSink> upload;
+        const Route *upload_route = nullptr;
+        bool sink_watched = false;      //sink写满时注册到epoll上等EPOLLOUT，上传结束时移除
+        //静态文件的body，output写完之后依次发出file_spans
+        int file_fd = -1;
+        std::vector<FileSpan> file_spans;
+        size_t span_index = 0;
+        //采样到的请求的trace id(0表示不采样)，以及用于计算跨线程阶段的时间点
+        std::uint64_t trace_id = 0;
+        std::uint64_t accepted_ns = 0;  //accept的时间，Tracer::Now()
+        std::uint64_t ready_ns = 0;     //响应准备好、交给事件循环写出的时间
+        //访问日志需要的信息
+        std::array<std::uint8_t, 16> peer_addr{};   //对端地址，格式同AccessEntry::peer_addr
+        std::uint16_t status = 0;       //已经序列化的响应的状态码
+        std::uint64_t bytes_sent = 0;
+        //MSG_ZEROCOPY：发出的次数和内核已经通知完成的次数，两者相等之前output不能释放
+        bool zerocopy_tried = false;
+        bool zerocopy = false;          //socket上已经打开SO_ZEROCOPY
+        std::uint32_t zerocopy_sends = 0;
+        std::uint32_t zerocopy_acked = 0;
+        //worker处理完之后通过CompletionQueue交还给事件循环时使用的链接
+        EventData *next_completed = nullptr;
+        //TLS监听地址接受的连接，明文连接为空
+        std::unique_ptr<TlsConnection> tls;
+        //事件流路由的连接，不为空时连接停在事件循环上等待EventChannel的事件
+        std::unique_ptr<Subscription> subscription;
+        //CloseConnection之后为true；同一批epoll事件里可能还有它的事件，这批处理完才释放
+        bool closed = false;
+
+        //要写出的响应
+        std::string_view Output() const {
+            return shared_output ? std::string_view(*shared_output) : std::string_view(output);
+        }
+    };
+
+    //监听socket的选项，接受的连接从监听socket继承这些选项
+    struct ListenerOptions {
+        bool tcp_nodelay = false;           //关闭Nagle，小的响应不等待ACK
+        int defer_accept_seconds = 0;       //TCP_DEFER_ACCEPT：连接收到数据之后才唤醒accept，0表示关闭
+        int fast_open_queue = 0;            //TCP Fast Open的队列长度，0表示关闭
+        int busy_poll_us = 0;               //SO_BUSY_POLL：读空socket时先轮询网卡队列这么久，0表示关闭
+        bool prefer_busy_poll = false;      //SO_PREFER_BUSY_POLL：应用在轮询时推迟网卡中断
+        //一批事件之后不阻塞地继续轮询epoll的最长时间，按是否等到事件自动加倍或减半，0表示直接阻塞
+        std::chrono::microseconds spin_before_block{0};
+
+        //延迟敏感的接口使用的配置
+        static ListenerOptions LowLatency();
+    };
+
+    //除了服务端连接之外注册到事件循环里的fd(例如HttpClient的连接和定时器)
+    //事件到达时在事件循环线程上调用OnEvents
+    class IoWatcher {
+    public:
+        virtual ~IoWatcher() = default;
+
+        virtual void OnEvents(std::uint32_t events) = 0;
     };
 
     using HttpRequestHandler_t = std::function<
@@ -46,8 +149,61 @@ namespace snow {
     CoroTask(const HttpRequest &)
 
     >;
+    //直接把响应写进连接输出缓冲区的handler
+    using ResponseWriterHandler_t = std::function<void(const HttpRequest &, ResponseWriter &)>;
+
+    //上传结束后交给handler的结果
+    struct UploadResult {
+        int fd;             //UploadSinkFactory_t返回的fd，所有权属于handler
+        size_t bytes;       //写入fd的body字节数
+        bool complete;      //false表示body没有完整收到(连接断开、chunked格式错误或写入失败)
+    };
+
+    //为一个上传请求打开sink(文件或管道)，在事件循环线程上调用，返回-1时回复500
+    //上传期间sink被设为非阻塞，管道写满时连接等sink可写，交给handler之前恢复原来的标志
+    using UploadSinkFactory_t = std::function<int(const HttpRequest &)>;
+    using UploadHandler_t = std::function<HttpResponse(const HttpRequest &, const UploadResult &)>;
+
+    //路由的执行策略，在注册时指定
+    enum class ExecutionPolicy {
+        kInline,        //直接在事件循环线程上执行，只适用于不会阻塞的handler
+        kWorkerPool,    //交给共享的worker线程池
+        kDedicatedPool  //交给独立的线程池，用于会阻塞或者CPU密集的handler，不会拖慢共享线程池
+    };
+
+    struct RouteOptions {
+        ExecutionPolicy policy = ExecutionPolicy::kWorkerPool;
+        //在线程池中排队时使用的优先级，kInline路由不排队
+        TaskPriority priority = TaskPriority::kNormal;
+        //从读到请求开始算起的截止时间，排队超过这个时间的请求直接回复503，0表示不限制
+        std::chrono::milliseconds deadline{0};
+    };
+
+    //事件流路由的订阅方式
+    enum class EventStreamMode {
+        kServerSentEvents,  //text/event-stream，连接一直保持，每个事件写成一帧
+        kLongPoll           //请求等到下一个事件，作为普通响应返回后关闭连接
+    };
+
+    //一个path + method对应的handler，handler、coro_handler、writer_handler、upload_handler和static_response只会设置其中一种
+    struct Route {
+        HttpRequestHandler_t handler;
+        CoroHttpRequestHandler_t coro_handler;
+        ResponseWriterHandler_t writer_handler;
+        UploadSinkFactory_t upload_sink;
+        UploadHandler_t upload_handler;
+        //固定响应和它序列化之后的字节，带Range的请求才会用到static_response本身
+        std::shared_ptr<const HttpResponse> static_response;
+        std::string static_output;
+        //事件流路由订阅的channel
+        EventChannel *channel = nullptr;
+        EventStreamMode stream_mode = EventStreamMode::kServerSentEvents;
+        RouteOptions options;
+    };
 
     class HttpServer {
+        friend class EventChannel;
+
     public:
         explicit HttpServer(const std::string &host, std::uint16_t port);
 
@@ -59,50 +215,237 @@ namespace snow {
 
         HttpServer &operator=(HttpServer &&) = default;
 
-        void Start();
+        //监听地址、访问日志或事件循环设置失败时返回false，服务器不会启动
+        bool Start();
 
         void Stop();
 
-        void RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
-                                        const CoroHttpRequestHandler_t callback) {
+        //准入控制配置，需要在Start()之前调用
+        void SetAdmissionConfig(const AdmissionConfig &config) {
+            admission_.Configure(config);
+        }
 
+        //打开访问日志，需要在Start()之前调用
+        void SetAccessLog(const AccessLogConfig &config) {
+            access_log_ = std::make_unique<AccessLog>(config);
         }
 
+        //共享worker线程池的线程数范围，默认按CPU数确定
+        void SetWorkerPoolSizing(const PoolSizing &sizing) {
+            thread_pool_.configure(sizing);
+        }
+
+        //动态生成的响应一次还剩至少min_bytes字节要发送时使用MSG_ZEROCOPY，
+        //更小的发送仍然拷贝。0表示关闭(默认)，需要在Start()之前调用
+        //一般只有几百KB以上的body才值得，因为每次发送都要额外处理一个完成通知
+        void SetZeroCopyThreshold(size_t min_bytes) {
+            zerocopy_threshold_ = min_bytes;
+        }
+
+        //构造函数指定的监听地址使用的选项，需要在Start()之前调用
+        void SetListenerOptions(const ListenerOptions &options) {
+            listener_options_ = options;
+        }
+
+        //再监听一个地址，所有监听地址共用同一个路由表、事件循环和线程池，需要在Start()之前调用
+        //endpoint的格式："127.0.0.1:8080"、"[::1]:8080"、"unix:/run/snow.sock"(文件)
+        //或"unix:@snow"(abstract，不在文件系统中)。地址不合法或者bind失败时返回false
+        //构造函数的host为空时，服务器只监听这里添加的地址
+        bool AddListener(const std::string &endpoint, const ListenerOptions &options = {});
+
+        //和AddListener一样，但连接先用tls完成TLS握手，之后的请求和响应都经过加密
+        //多个监听地址可以共用一个TlsContext，从而共用session缓存
+        bool AddTlsListener(const std::string &endpoint, std::shared_ptr<TlsContext> tls,
+                            const ListenerOptions &options = {});
+
+        //线程绑定的CPU，需要在Start()之前调用
+        void SetThreadTopology(const ThreadTopology &topology) {
+            topology_ = topology;
+        }
+
+        //注册handler，需要在Start()之前调用，之后路由表只读，可以被多个线程同时访问
+        void RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
+                                        const HttpRequestHandler_t &callback, RouteOptions options = {});
+
+        void RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
+                                        const CoroHttpRequestHandler_t &callback, RouteOptions options = {});
+
+        //handler用ResponseWriter把状态、header和body直接写进连接的输出缓冲区，不构造HttpResponse
+        //Connection和Content-Length由服务器写出，HEAD请求的body会被去掉
+        void RegisterHttpRequestHandler(const std::string &path, HttpMethod method,
+                                        const ResponseWriterHandler_t &callback, RouteOptions options = {});
+
+        //上传路由：body不经过用户空间，直接从socket splice到open_sink返回的fd中，
+        //支持Content-Length和chunked。body收完后按options的执行策略调用callback，
+        //此时request的content为空。body没有完整收到时也会在事件循环线程上调用callback，
+        //complete为false，返回的响应被忽略
+        void RegisterUploadHandler(const std::string &path, HttpMethod method, const UploadSinkFactory_t &open_sink,
+                                   const UploadHandler_t &callback, RouteOptions options = {});
+
+        //固定的响应(健康检查、robots.txt之类)：注册时只序列化一次，匹配的请求在事件循环线程上
+        //直接写出这份共享的字节，不调用handler、不分配内存、不经过线程池
+        //带Range的GET请求按ApplyRanges回复206或416
+        void RegisterStaticResponse(const std::string &path, HttpMethod method, HttpResponse response);
+
+        //把url_prefix下的GET/HEAD请求映射到directory中的文件，只在没有匹配的路由时使用
+        //支持Range(单个和多个区间)和If-Range，文件内容用sendfile发送，需要在Start()之前调用
+        void ServeStaticFiles(const std::string &url_prefix, const std::string &directory);
+
+        //path的GET请求订阅channel：SSE的连接保持打开，收到之后发布的每个事件；
+        //长轮询的请求等到下一个事件(或Ping)作为响应。等待的连接不占用线程，需要在Start()之前调用
+        void RegisterEventStream(const std::string &path, EventChannel &channel,
+                                 EventStreamMode mode = EventStreamMode::kServerSentEvents);
+
+        //把fd交给事件循环监听，可以在任意线程调用，需要在Start()之后
+        bool Watch(int fd, std::uint32_t events, IoWatcher *watcher);
+
+        bool Rewatch(int fd, std::uint32_t events, IoWatcher *watcher);
+
+        void Unwatch(int fd);
+
     private:
         static constexpr int kBackLogSize = 1000;
         static constexpr int kMaxConnections = 10000;
         static constexpr int kMaxEvents = 10000;
+        static constexpr size_t kDedicatedPoolSize = 4;
+        //拒绝连接时最多读取并丢弃这么多次请求数据，不让一直发送的客户端占住事件循环
+        static constexpr int kRejectDrainReads = 2;
+        //空闲的读缓冲区最多保留这么多个，更多的在归还时释放
+        static constexpr size_t kMaxCachedReadBuffers = 1024;
+
+        // epoll_event.data holds an EventData* for a server connection, an IoWatcher*
+        // tagged with kWatcherTag, a Listener* tagged with kListenerTag, or the
+        // CompletionQueue tagged with kCompletionTag. All of them are at least 8-byte
+        // aligned, so the low bits are free.
+        static constexpr std::uint64_t kWatcherTag = 1;
+        static constexpr std::uint64_t kListenerTag = 2;
+        static constexpr std::uint64_t kCompletionTag = 4;
+
+        //一个监听地址，Stop()只关闭fd，配置保留到下一次Start()重新创建socket
+        struct Listener {
+            std::string endpoint;
+            ListenerOptions options;
+            int fd = -1;
+            bool from_host = false;     //构造函数的host_:port_，每次Start()按当时的listener_options_重新添加
+            std::string unix_path;      //文件系统中的Unix socket，Stop()时删除
+            std::shared_ptr<TlsContext> tls;    //明文监听地址为空
+        };
 
         std::string host_;
         std::uint16_t port_;
-        int sock_fd;
+        std::vector<std::unique_ptr<Listener>> listeners_;
+        int epoll_fd_;
         bool running_;
         std::thread listener_thread_;
 
-        ThreadPool thread_pool_;
+        AdmissionController admission_;
+        ThreadTopology topology_;
+        std::unique_ptr<AccessLog> access_log_;
+        ReadBufferPool read_buffers_{kMaxBufferSize, kMaxCachedReadBuffers};    //只在事件循环线程上使用
+        std::unique_ptr<CompletionQueue> completions_;     //worker写好响应的连接，第一次Start()时创建，之后一直保留
+        std::vector<EventData *> closed_;      //这批epoll事件中关闭的连接，只在事件循环线程上使用
+        size_t zerocopy_threshold_ = 0;
+        ListenerOptions listener_options_;
+        std::chrono::microseconds spin_limit_{0};      //所有监听地址中最大的spin_before_block
 
-        std::map <Uri, std::map<HttpMethod, HttpRequestHandler_t>> request_handlers_;
-        std::map <Uri, std::map<HttpMethod, CoroHttpRequestHandler_t>> coro_request_handlers_;
+        std::map<std::string, std::map<HttpMethod, Route>, std::less<>> routes_;
+        std::vector<std::pair<std::string, std::string>> static_dirs_;     //url前缀和目录
+        std::vector<EventChannel *> channels_;      //Start()时监听它们的eventfd
 
         std::mt19937 rng_;
         std::uniform_int_distribution<int> sleep_times_;
 
-        void CreateSocket();
+        //线程池放在最后，最先析构：~ThreadPool会执行完排队的任务，这些任务还要用到路由表、
+        //admission_和completions_，它们必须在线程池退出之后才析构
+        ThreadPool thread_pool_;
+        std::unique_ptr<ThreadPool> dedicated_pool_;   //第一次注册kDedicatedPool路由时创建
+
+        bool CreateSocket(Listener *listener);
 
         void SetUpEpoll();
 
+        void AcceptConnections(int epoll_fd, Listener *listener);
+
         void Listen();
 
+        void FreeClosedConnections();
+
         void ProcessEvents();
 
+        int WaitForEvents(int epoll_fd, epoll_event *events, std::chrono::microseconds *spin);
+
         void HandleEpollEvent(int epoll_fd, EventData *event, std::uint32_t events);
 
-        void HandleHttpData(const EventData &request, EventData *response);
+        void ReadRequest(int epoll_fd, EventData *event);
+
+        void ContinueHandshake(int epoll_fd, EventData *event);
+
+        //通过准入控制时返回true，否则回复拒绝的响应并关闭连接
+        bool AdmitRequest(int epoll_fd, EventData *event);
+
+        void RejectConnection(int epoll_fd, EventData *event, AdmissionVerdict verdict);
+
+        void DispatchRequest(int epoll_fd, EventData *event);
+
+        void RunHandler(int epoll_fd, EventData *event, const Route *route, std::function<bool()> work,
+                        std::function<void()> on_expired = {});
+
+        void StartUpload(int epoll_fd, EventData *event, const Route *route);
+
+        void ContinueUpload(int epoll_fd, EventData *event, UploadSink::Status status);
+
+        static UploadSink::Status PumpUpload(EventData *event);
+
+        bool ServeStaticFile(int epoll_fd, EventData *event);
+
+        void ServeStaticResponse(int epoll_fd, EventData *event, const Route *route);
+
+        void Subscribe(int epoll_fd, EventData *event, const Route *route);
+
+        void ContinueSubscription(int epoll_fd, EventData *event, std::uint32_t events);
+
+        //写出SSE响应头和排队的事件，直到写完或者socket缓冲区满
+        void WriteStream(int epoll_fd, EventData *event);
+
+        static void Unsubscribe(EventData *event);
+
+        //在事件循环线程上把一次发布交给channel的所有订阅者，由EventChannel调用
+        void Broadcast(EventChannel *channel, const std::shared_ptr<const std::string> &frame,
+                       const std::shared_ptr<const std::string> &long_poll, std::uint16_t long_poll_status);
+
+        static void SetResponse(EventData *event, HttpResponse &response, bool send_content = true);
+
+        const Route *FindRoute(std::string_view request) const;
+
+        void AddRoute(const std::string &path, HttpMethod method, Route route);
+
+        void WriteResponse(int epoll_fd, EventData *event);
+
+        //写出CompletionQueue中所有已经准备好响应的连接
+        void WriteCompletions(int epoll_fd);
+
+        ssize_t SendOutput(EventData *event);
+
+        static void ReapZeroCopy(EventData *event);
+
+        //请求已经处理完，把读缓冲区还给read_buffers_，可以重复调用
+        void ReleaseReadBuffer(EventData *event);
+
+        void CloseConnection(int epoll_fd, EventData *event);
+
+        void LogAccess(const EventData *event);
+
+        bool HandleHttpData(const EventData &request, EventData *response, const Route *route);
+
+        void HandleCoroutine(EventData *response, const Route *route, HttpRequest request);
 
         HttpResponse HandleHttpRequest(const HttpRequest &request);
 
         CoroTask HandleCoroHttpRequest(const HttpRequest &request);
 
+        //重新注册连接fd关心的事件(EPOLLONESHOT)，把连接交还给事件循环
+        void Arm(int epoll_fd, EventData *event, std::uint32_t events);
+
         void control_epoll_envent(int epoll_fd, int op, int fd, std::uint32_t events = 0, void *data = nullptr);
     };
 
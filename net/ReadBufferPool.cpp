@@ -0,0 +1,27 @@
+#include "ReadBufferPool.h"
+
+namespace snow {
+    ReadBufferPool::ReadBufferPool(size_t buffer_size, size_t max_cached)
+            : buffer_size_(buffer_size), max_cached_(max_cached) {}
+
+    char *ReadBufferPool::Acquire() {
+        ++outstanding_;
+        if (free_.empty()) {
+            // Not value-initialized: the bytes are always written by read(2) first
+            return new char[buffer_size_];
+        }
+        char *buffer = free_.back().release();
+        free_.pop_back();
+        return buffer;
+    }
+
+    void ReadBufferPool::Release(char *buffer) {
+        --outstanding_;
+        if (free_.size() >= max_cached_) {
+            delete[] buffer;
+            return;
+        }
+        free_.emplace_back(buffer);
+    }
+
+} // snow
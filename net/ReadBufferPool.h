@@ -0,0 +1,48 @@
+#ifndef SNOW_HTTP_SERVER_READBUFFERPOOL_H
+#define SNOW_HTTP_SERVER_READBUFFERPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace snow {
+
+    // Fixed-size read buffers lent to connections by the event loop.
+    //
+    // A connection only needs somewhere to read into between the moment its socket
+    // becomes readable and the moment its request has been consumed; before that, and
+    // while it waits on a handler's response, a slow client or an event stream, it
+    // holds no buffer at all. The buffers in use therefore track requests in flight,
+    // not open connections.
+    //
+    // Released buffers are kept for reuse up to max_cached, so the steady state never
+    // allocates; a burst beyond that is freed again once it is over. Not thread-safe:
+    // the pool belongs to the loop thread.
+    class ReadBufferPool {
+    public:
+        ReadBufferPool(size_t buffer_size, size_t max_cached);
+
+        ReadBufferPool(ReadBufferPool &&) = default;
+
+        ReadBufferPool &operator=(ReadBufferPool &&) = default;
+
+        //返回buffer_size字节的缓冲区，内容未初始化
+        char *Acquire();
+
+        void Release(char *buffer);
+
+        size_t buffer_size() const { return buffer_size_; }
+
+        //借出去还没有归还的缓冲区数量
+        size_t outstanding() const { return outstanding_; }
+
+    private:
+        size_t buffer_size_;
+        size_t max_cached_;
+        size_t outstanding_ = 0;
+        std::vector<std::unique_ptr<char[]>> free_;
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_READBUFFERPOOL_H
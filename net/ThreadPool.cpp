@@ -4,85 +4,262 @@
 
 #include "ThreadPool.h"
 
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "ThreadTopology.h"
+
 namespace snow {
 
 // The ThreadPool class manages a set of worker threads to execute tasks.
+    PoolSizing PoolSizing::ForHardware() {
+        size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+        PoolSizing sizing;
+        sizing.min_threads = cpus;
+        sizing.max_threads = cpus * 4;
+        return sizing;
+    }
+
     // Constructor: Initializes the thread pool with a specified number of threads.
-    ThreadPool::ThreadPool(size_t threads) : stop(false) {
-        // Create the specified number of worker threads.
+    ThreadPool::ThreadPool(size_t threads)
+            : live_workers(0), idle_workers(0), spawned(0), elastic(false), credits(kWeights), pending_tasks(0),
+              head_enqueued_ns(0), stop(false) {
+        sizing.min_threads = sizing.max_threads = sizing.max_total_threads = threads;
+        std::unique_lock <std::mutex> lock(queue_mutex);
         for (size_t i = 0; i < threads; ++i) {
-            // Emplace a new thread into the 'workers' vector.
-            // The thread executes the provided lambda function.
-            workers.emplace_back([this] {
-                // Each worker thread enters an infinite loop to continuously process tasks.
-                while (true) {
-                    std::function<void()> task; // Placeholder for the task to be executed.
-                    {
-                        // Acquire a unique lock on the queue_mutex.
-                        // This protects the shared task queue from concurrent access.
-                        std::unique_lock <std::mutex> lock(this->queue_mutex);
-
-                        // The thread waits here until a condition is met.
-                        // It atomically releases the lock and goes to sleep.
-                        // It wakes up and re-acquires the lock when either:
-                        // 1. The 'stop' flag is true (shutdown).
-                        // 2. The task queue is not empty.
-                        this->condition.wait(lock, [this] {
-                            return this->stop || !this->tasks.empty();
-                        });
-
-                        // After waking up, check if the pool is shutting down
-                        // and there are no more tasks.
-                        if (this->stop && this->tasks.empty()) {
-                            // If so, the thread safely exits its loop.
-                            return;
-                        }
-
-                        // Get the next task from the front of the queue.
-                        // std::move is used for efficiency to transfer ownership.
-                        task = std::move(this->tasks.front());
-                        // Remove the task from the queue.
-                        this->tasks.pop();
-
-                    } // The lock is automatically released here as 'lock' goes out of scope.
-
-                    // Execute the retrieved task outside the lock.
-                    // This allows other threads to access the queue while this thread is busy.
-                    task();
-                }
-            });
+            spawn_worker();
         }
     }
 
+    ThreadPool::ThreadPool(const PoolSizing &sizing)
+            : live_workers(0), idle_workers(0), spawned(0), elastic(false), credits(kWeights), pending_tasks(0),
+              head_enqueued_ns(0), stop(false) {
+        configure(sizing);
+    }
+
+    void ThreadPool::configure(const PoolSizing &new_sizing) {
+        {
+            std::unique_lock <std::mutex> lock(queue_mutex);
+            sizing = new_sizing;
+            sizing.min_threads = std::max<size_t>(sizing.min_threads, 1);
+            sizing.max_threads = std::max(sizing.max_threads, sizing.min_threads);
+            if (sizing.max_total_threads == 0) {
+                sizing.max_total_threads = sizing.max_threads * kDefaultTotalFactor;
+            }
+            sizing.max_total_threads = std::max(sizing.max_total_threads, sizing.max_threads);
+            while (live_workers.load(std::memory_order_relaxed) < sizing.min_threads) {
+                spawn_worker();
+            }
+            start_monitor();
+        }
+        // Idle workers above the new minimum start their idle countdown.
+        condition.notify_all();
+    }
+
     ThreadPool::~ThreadPool() {
         {
             std::unique_lock <std::mutex> lock(queue_mutex);
             stop = true;
         }
         condition.notify_all();
-        for (std::thread &worker: workers) {
-            worker.join();
+        monitor_wake.notify_all();
+        if (monitor.joinable()) {
+            monitor.join();
+        }
+        for (auto &worker: workers) {
+            worker->thread.join();
+        }
+    }
+
+    void ThreadPool::spawn_worker() {
+        workers.push_back(std::make_unique<Worker>());
+        Worker *worker = workers.back().get();
+        live_workers.fetch_add(1, std::memory_order_relaxed);
+        // Emplace a new thread into the worker list.
+        worker->thread = std::thread(&ThreadPool::worker_loop, this, worker);
+        if (!pin_cpus.empty()) {
+            PinThread(worker->thread.native_handle(), pin_cpus[spawned % pin_cpus.size()]);
+        }
+        ++spawned;
+    }
+
+    void ThreadPool::start_monitor() {
+        if (!elastic) {
+            elastic = true;
+            monitor = std::thread(&ThreadPool::monitor_loop, this);
+        }
+    }
+
+    void ThreadPool::worker_loop(Worker *self) {
+        self->tid.store(static_cast<pid_t>(syscall(SYS_gettid)), std::memory_order_relaxed);
+        // Each worker thread enters a loop to continuously process tasks.
+        while (true) {
+            Task task; // Placeholder for the task to be executed.
+            {
+                // Acquire a unique lock on the queue_mutex.
+                // This protects the shared task queues from concurrent access.
+                std::unique_lock <std::mutex> lock(this->queue_mutex);
+
+                // The thread waits here until the pool is shutting down or any of the
+                // task queues is not empty. Workers above the minimum only wait for
+                // idle_timeout; one that stays idle that long leaves the pool.
+                ++idle_workers;
+                bool retire = false;
+                while (!this->stop && this->pending_tasks.load(std::memory_order_relaxed) == 0) {
+                    if (live_workers.load(std::memory_order_relaxed) <= sizing.min_threads) {
+                        this->condition.wait(lock);
+                    } else if (this->condition.wait_for(lock, sizing.idle_timeout) == std::cv_status::timeout &&
+                               !this->stop && this->pending_tasks.load(std::memory_order_relaxed) == 0 &&
+                               live_workers.load(std::memory_order_relaxed) > sizing.min_threads) {
+                        retire = true;
+                        break;
+                    }
+                }
+                --idle_workers;
+
+                if (retire) {
+                    // The monitor joins the thread and frees self.
+                    live_workers.fetch_sub(1, std::memory_order_relaxed);
+                    self->exited = true;
+                    return;
+                }
+
+                // After waking up, check if the pool is shutting down
+                // and there are no more tasks.
+                if (this->stop && this->pending_tasks.load(std::memory_order_relaxed) == 0) {
+                    // If so, the thread safely exits its loop.
+                    return;
+                }
+
+                // Take the next task according to the weighted-fair policy.
+                task = this->pop_next();
+
+            } // The lock is automatically released here as 'lock' goes out of scope.
+
+            // Execute the retrieved task outside the lock.
+            // Work that waited past its deadline is not worth doing any more:
+            // the client has most likely given up, so only tell it so.
+            self->busy_since.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            if (Clock::now() > task.deadline) {
+                if (task.on_expired) task.on_expired();
+            } else {
+                task.fn();
+            }
+            self->busy_since.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    namespace {
+        // A thread that is sleeping ('S') or in uninterruptible wait ('D') while it
+        // runs a task is blocked in a system call (or on a lock), not using its CPU.
+        bool ThreadBlocked(pid_t tid) {
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/self/task/%d/stat", static_cast<int>(tid));
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                return false;
+            }
+            char stat[256];
+            ssize_t length = read(fd, stat, sizeof(stat) - 1);
+            close(fd);
+            if (length <= 0) {
+                return false;
+            }
+            stat[length] = '\0';
+            // "tid (comm) S ...": comm may itself contain ')', so look for the last one
+            const char *paren = strrchr(stat, ')');
+            return paren && paren[1] == ' ' && (paren[2] == 'S' || paren[2] == 'D');
+        }
+    } // namespace
+
+    // Grows the pool when tasks wait and every worker is busy, and makes up for
+    // workers that are blocked: max_threads bounds the workers that can run, so a
+    // worker stuck in a system call does not count against it. max_total_threads
+    // bounds all of them: past it, tasks wait for a blocked worker to come back.
+    void ThreadPool::monitor_loop() {
+        struct Busy {
+            pid_t tid;
+            std::int64_t since;
+        };
+        std::vector<Busy> busy;
+        std::vector<std::thread> exited;
+        std::unique_lock <std::mutex> lock(queue_mutex);
+        while (!stop) {
+            monitor_wake.wait_for(lock, sizing.monitor_interval);
+            if (stop) {
+                break;
+            }
+
+            busy.clear();
+            for (auto it = workers.begin(); it != workers.end();) {
+                Worker &worker = **it;
+                if (worker.exited) {
+                    exited.push_back(std::move(worker.thread));
+                    it = workers.erase(it);
+                    continue;
+                }
+                std::int64_t since = worker.busy_since.load(std::memory_order_relaxed);
+                if (since != 0) {
+                    busy.push_back(Busy{worker.tid.load(std::memory_order_relaxed), since});
+                }
+                ++it;
+            }
+            size_t live = live_workers.load(std::memory_order_relaxed);
+            size_t idle = idle_workers;
+            size_t pending = pending_tasks.load(std::memory_order_relaxed);
+            PoolSizing limits = sizing;
+
+            // /proc reads and joins happen without the lock
+            lock.unlock();
+            for (std::thread &thread: exited) {
+                thread.join();
+            }
+            exited.clear();
+
+            size_t grow = 0;
+            if (pending > 0 && idle == 0) {
+                // Only tasks that have run for a whole interval are checked, so short
+                // waits (a page fault, a brief lock) are not mistaken for blocking.
+                std::int64_t now = Clock::now().time_since_epoch().count();
+                std::int64_t threshold = std::chrono::duration_cast<Clock::duration>(limits.monitor_interval).count();
+                size_t blocked = 0;
+                for (const Busy &worker: busy) {
+                    if (worker.tid != 0 && now - worker.since >= threshold && ThreadBlocked(worker.tid)) {
+                        ++blocked;
+                    }
+                }
+                size_t runnable = live > blocked ? live - blocked : 0;
+                bool backlog = queue_wait() >= limits.grow_queue_wait || pending >= limits.grow_queue_depth;
+                size_t room = live < limits.max_total_threads ? limits.max_total_threads - live : 0;
+                if (runnable < limits.max_threads && (blocked > 0 || backlog)) {
+                    grow = std::min({pending, limits.max_threads - runnable, room});
+                }
+            }
+
+            lock.lock();
+            for (size_t i = 0; i < grow && !stop; ++i) {
+                spawn_worker();
+            }
+        }
+        lock.unlock();
+        for (std::thread &thread: exited) {
+            thread.join();
         }
     }
 
-    template<class F, class ...Args>
-    auto ThreadPool::enqueue(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type> {
-        // Determine the return type of the function F with arguments Args...
-        using return_type = typename std::result_of<F(Args...)>::type;
-
-        // Create a shared pointer to a packaged_task.
-        // The packaged_task is specialized to wrap a function that takes no arguments and returns `return_type`.
-        // std::bind is used to create a function object that binds the provided function `f` to its arguments `args...`.
-        // std::forward is used for perfect forwarding, preserving the lvalue/rvalue nature of the arguments.
-        auto task = std::make_shared < std::packaged_task < return_type() >> (
-                std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
-
-        // Get the future associated with the packaged_task.
-        // This future will be used by the caller to retrieve the result.
-        std::future <return_type> res = task->get_future();
+    void ThreadPool::submit(TaskPriority priority, Clock::time_point deadline,
+                            std::function<void()> fn, std::function<void()> on_expired) {
+        push(priority, Task{std::move(fn), std::move(on_expired), Clock::now(), deadline});
+    }
+
+    void ThreadPool::push(TaskPriority priority, Task task) {
         {
-            // Acquire a unique lock to protect the shared task queue.
+            // Acquire a unique lock to protect the shared task queues.
             std::unique_lock <std::mutex> lock(queue_mutex);
 
             // Check if the thread pool is in a stopped state.
@@ -91,36 +268,74 @@ namespace snow {
                 throw std::runtime_error("enqueue on stopped ThreadPool");
             }
 
-            // Add the task to the queue.
-            // We use a lambda to wrap the packaged_task. This lambda has the required `void()` signature
-            // for the `std::function` in the queue.
-            // The lambda captures the shared pointer `task` by value, ensuring the packaged_task
-            // object remains alive until a worker thread processes it.
-            tasks.emplace([task]() {
-                (*task)(); // Execute the packaged_task. This will run the function `f` and set the result in the future.
-            });
+            tasks[static_cast<size_t>(priority)].push(std::move(task));
+            publish_queue_state();
         } // The lock is automatically released here.
 
         // Notify one of the waiting worker threads that a new task is available.
         condition.notify_one();
-
-        // Return the future to the caller.
-        return res;
     }
 
+    ThreadPool::Task ThreadPool::pop_next() {
+        // Serve the most urgent class that still has credit in this round. When every
+        // non-empty class has used up its share, start a new round.
+        for (int round = 0; round < 2; ++round) {
+            for (size_t p = 0; p < kPriorityCount; ++p) {
+                if (!tasks[p].empty() && credits[p] > 0) {
+                    --credits[p];
+                    Task task = std::move(tasks[p].front());
+                    tasks[p].pop();
+                    publish_queue_state();
+                    return task;
+                }
+            }
+            credits = kWeights;
+        }
+        // Unreachable while pending_tasks != 0: every class has credit after a refill.
+        return Task{};
+    }
 
-    //模板显式实例化
-    template auto ThreadPool::enqueue<std::function < void()>>
-    (
-    std::function<void()> f
-    ) ->
-    std::future<void>;
-    template auto ThreadPool::enqueue<std::function
-    <
+    void ThreadPool::publish_queue_state() {
+        size_t pending = 0;
+        std::int64_t oldest = 0;
+        for (const auto &queue: tasks) {
+            pending += queue.size();
+            if (!queue.empty()) {
+                std::int64_t enqueued = queue.front().enqueued_at.time_since_epoch().count();
+                if (oldest == 0 || enqueued < oldest) oldest = enqueued;
+            }
+        }
+        pending_tasks.store(pending, std::memory_order_relaxed);
+        head_enqueued_ns.store(oldest, std::memory_order_relaxed);
+    }
 
-    HttpResponse(const HttpRequest &)
+    bool ThreadPool::pin(const std::vector<int> &cpus) {
+        if (cpus.empty()) {
+            return true;
+        }
+        // One CPU per worker rather than the whole set: a worker that never migrates
+        // keeps its arena and stack in its own core's cache and on its own node.
+        std::unique_lock <std::mutex> lock(queue_mutex);
+        pin_cpus = cpus;
+        bool all_pinned = true;
+        size_t i = 0;
+        for (auto &worker: workers) {
+            if (!worker->exited) {
+                all_pinned &= PinThread(worker->thread.native_handle(), cpus[i % cpus.size()]);
+            }
+            ++i;
+        }
+        spawned = i;
+        return all_pinned;
+    }
 
-    >, const HttpRequest&>(std::function<HttpResponse(const HttpRequest &)>, const HttpRequest&) ->
-    std::future<HttpResponse>;
+    std::chrono::microseconds ThreadPool::queue_wait() const {
+        std::int64_t head = head_enqueued_ns.load(std::memory_order_relaxed);
+        if (head == 0) {
+            return std::chrono::microseconds(0);
+        }
+        auto now = Clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::microseconds>(now - Clock::duration(head));
+    }
 
-} // snow
\ No newline at end of file
+} // snow
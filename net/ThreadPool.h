@@ -5,6 +5,12 @@
 #ifndef SNOW_HTTP_SERVER_THREADPOOL_H
 #define SNOW_HTTP_SERVER_THREADPOOL_H
 
+#include <sys/types.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
 #include <vector>
 #include <queue>
 #include <thread>
@@ -12,31 +18,176 @@
 #include <condition_variable>
 #include <future>
 #include <functional>
+#include <memory>
+#include <stdexcept>
 
 #include "http/http_message.h"
 
 namespace snow {
 
+    //任务的优先级，每个优先级有自己的队列
+    enum class TaskPriority {
+        kCritical = 0,  //延迟敏感的接口
+        kNormal = 1,
+        kBatch = 2      //报表、导出之类慢而不急的请求
+    };
+
+    //弹性线程池的线程数范围和伸缩条件
+    struct PoolSizing {
+        size_t min_threads = 1;
+        //可运行(没有阻塞在系统调用里)的worker数上限，阻塞的worker由额外的线程补偿
+        size_t max_threads = 1;
+        //包括阻塞的worker在内的线程总数上限，达到之后不再补偿，0表示max_threads的4倍
+        size_t max_total_threads = 0;
+        //没有空闲worker并且队首任务等待超过grow_queue_wait，或者排队任务数达到
+        //grow_queue_depth时增加线程
+        std::chrono::microseconds grow_queue_wait = std::chrono::milliseconds(2);
+        size_t grow_queue_depth = 64;
+        //超过min_threads的线程空闲这么久之后退出
+        std::chrono::milliseconds idle_timeout = std::chrono::seconds(10);
+        //监控线程检查队列和阻塞线程的间隔
+        std::chrono::milliseconds monitor_interval{5};
+
+        //按本机CPU数确定：每个CPU一个常驻线程，最多每个CPU四个
+        static PoolSizing ForHardware();
+    };
+
     class ThreadPool {
     public:
-        ThreadPool(size_t threads);
+        using Clock = std::chrono::steady_clock;
+
+        //没有截止时间的任务使用这个值
+        static constexpr Clock::time_point kNoDeadline = Clock::time_point::max();
+
+        //固定threads个线程，不伸缩
+        explicit ThreadPool(size_t threads);
+
+        //线程数在sizing的范围内随负载伸缩
+        explicit ThreadPool(const PoolSizing &sizing);
 
         ~ThreadPool();
 
-        //入队函数，这里使用是为了异步处理
+        //入队函数，这里使用是为了异步处理，任务按kNormal优先级排队
         template<class F, class ...Args>
-        auto enqueue(F &&f, Args &&... args) -> std::futrue<typename std::result_of<F(Args...)>::type>;
+        auto enqueue(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+
+        //按优先级入队。如果任务在deadline之前还没有被取出执行，就不再执行fn，
+        //而是执行on_expired(可以为空)，用来给客户端回复503
+        void submit(TaskPriority priority, Clock::time_point deadline,
+                    std::function<void()> fn, std::function<void()> on_expired = {});
+
+        //当前排队等待执行的任务数，无锁读取，供准入控制使用
+        size_t pending() const {
+            return pending_tasks.load(std::memory_order_relaxed);
+        }
+
+        //所有队列中最早入队的任务已经等待的时间，队列为空时为0
+        std::chrono::microseconds queue_wait() const;
+
+        //修改线程数范围，固定大小的线程池也会变成弹性的。多出来的线程空闲之后退出
+        void configure(const PoolSizing &sizing);
+
+        //当前的worker线程数
+        size_t size() const {
+            return live_workers.load(std::memory_order_relaxed);
+        }
+
+        //把第i个worker绑定到cpus[i % cpus.size()]，cpus为空时不做任何事，之后创建的
+        //worker也按同样的规则绑定。有worker绑定失败时返回false
+        bool pin(const std::vector<int> &cpus);
 
     private:
-        std::vector <std::thread> workers;
-        //The task queue
-        std::queue <std::function<void()>> tasks;
+        static constexpr size_t kPriorityCount = 3;
+        //PoolSizing::max_total_threads的默认值是max_threads的倍数
+        static constexpr size_t kDefaultTotalFactor = 4;
+
+        //Weighted-fair share of dequeues per round: out of every 13 tasks taken while
+        //all queues are busy, 8 are critical, 4 normal and 1 batch, so batch work still
+        //makes progress but can never hold up critical requests for long.
+        static constexpr std::array<int, kPriorityCount> kWeights = {8, 4, 1};
+
+        //A queued task together with the time it was enqueued.
+        struct Task {
+            std::function<void()> fn;
+            std::function<void()> on_expired;
+            Clock::time_point enqueued_at;
+            Clock::time_point deadline;
+        };
+
+        struct Worker {
+            std::thread thread;
+            std::atomic<pid_t> tid{0};
+            //正在执行的任务开始的时间(Clock的纳秒数)，空闲时为0
+            std::atomic<std::int64_t> busy_since{0};
+            bool exited = false;    //线程已经退出，等待监控线程join
+        };
+
+        std::list<std::unique_ptr<Worker>> workers;
+        std::atomic<size_t> live_workers;
+        size_t idle_workers;
+        size_t spawned;             //创建过的worker总数，用于选择绑定的CPU
+        std::vector<int> pin_cpus;
+        PoolSizing sizing;
+        bool elastic;
+        std::thread monitor;
+        std::condition_variable monitor_wake;
+        //The task queues, one per priority class
+        std::array<std::queue<Task>, kPriorityCount> tasks;
+        //Dequeues left for each class in the current weighted round
+        std::array<int, kPriorityCount> credits;
+
+        //Mirrors of the queue state that can be read without taking queue_mutex.
+        //head_enqueued_ns is the enqueue time of the oldest queued task (0 when empty).
+        std::atomic<size_t> pending_tasks;
+        std::atomic<std::int64_t> head_enqueued_ns;
 
         std::mutex queue_mutex;
         std::condition_variable condition;
         bool stop;
+
+        void push(TaskPriority priority, Task task);
+
+        void worker_loop(Worker *self);
+
+        void monitor_loop();
+
+        //The four below must be called with queue_mutex held.
+        void spawn_worker();
+
+        void start_monitor();
+
+        Task pop_next();
+
+        void publish_queue_state();
     };
 
+    template<class F, class ...Args>
+    auto ThreadPool::enqueue(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type> {
+        // Determine the return type of the function F with arguments Args...
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        // Create a shared pointer to a packaged_task.
+        // The packaged_task is specialized to wrap a function that takes no arguments and returns `return_type`.
+        // std::bind is used to create a function object that binds the provided function `f` to its arguments `args...`.
+        // std::forward is used for perfect forwarding, preserving the lvalue/rvalue nature of the arguments.
+        auto task = std::make_shared<std::packaged_task<return_type()>>(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+        );
+
+        // Get the future associated with the packaged_task.
+        // This future will be used by the caller to retrieve the result.
+        std::future<return_type> res = task->get_future();
+
+        // The lambda captures the shared pointer `task` by value, ensuring the packaged_task
+        // object remains alive until a worker thread processes it.
+        submit(TaskPriority::kNormal, kNoDeadline, [task]() {
+            (*task)(); // Execute the packaged_task. This will run the function `f` and set the result in the future.
+        });
+
+        // Return the future to the caller.
+        return res;
+    }
+
 } // snow
 
 #endif //SNOW_HTTP_SERVER_THREADPOOL_H
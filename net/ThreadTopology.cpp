@@ -0,0 +1,84 @@
+#include "ThreadTopology.h"
+
+#include <sched.h>
+
+#include <charconv>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+namespace snow {
+    namespace {
+        // Parses the kernel's cpulist format, e.g. "0-3,8-11".
+        std::vector<int> ParseCpuList(std::string_view list) {
+            std::vector<int> cpus;
+            while (!list.empty()) {
+                size_t comma = list.find(',');
+                std::string_view item = list.substr(0, comma);
+                list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+                int first = 0, last = 0;
+                size_t dash = item.find('-');
+                auto parse = [](std::string_view text, int *out) {
+                    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), *out);
+                    return error == std::errc() && end == text.data() + text.size();
+                };
+                if (dash == std::string_view::npos) {
+                    if (!parse(item, &first)) continue;
+                    last = first;
+                } else if (!parse(item.substr(0, dash), &first) || !parse(item.substr(dash + 1), &last)) {
+                    continue;
+                }
+                for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+            }
+            return cpus;
+        }
+    } // namespace
+
+    ThreadTopology ThreadTopology::ForNumaNode(int node) {
+        ThreadTopology topology;
+        std::vector<int> cpus = NumaNodeCpus(node);
+        if (cpus.empty()) {
+            return topology;
+        }
+        topology.loop_cpu = cpus.front();
+        if (cpus.size() > 1) {
+            topology.worker_cpus.assign(cpus.begin() + 1, cpus.end());
+        } else {
+            topology.worker_cpus = cpus;
+        }
+        topology.dedicated_worker_cpus = topology.worker_cpus;
+        return topology;
+    }
+
+    std::vector<int> NumaNodeCpus(int node) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!std::getline(file, list)) {
+            return {};
+        }
+        return ParseCpuList(list);
+    }
+
+    bool PinThread(pthread_t thread, int cpu) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+    }
+
+    bool PinCurrentThread(int cpu) {
+        return PinThread(pthread_self(), cpu);
+    }
+
+    bool SetIrqAffinity(int irq, int cpu) {
+        std::ofstream file("/proc/irq/" + std::to_string(irq) + "/smp_affinity_list");
+        file << cpu;
+        file.flush();
+        return static_cast<bool>(file);
+    }
+
+} // snow
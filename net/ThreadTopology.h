@@ -0,0 +1,44 @@
+#ifndef SNOW_HTTP_SERVER_THREADTOPOLOGY_H
+#define SNOW_HTTP_SERVER_THREADTOPOLOGY_H
+
+#include <pthread.h>
+
+#include <vector>
+
+namespace snow {
+
+    // Where the server's threads run. A thread that stays on one CPU keeps its
+    // connection state and buffers in that CPU's caches, and because Linux allocates
+    // memory on the node of the CPU that first touches it, everything a pinned thread
+    // allocates for itself (EventData, request arenas, stacks) lands on its local
+    // NUMA node without any explicit NUMA allocation.
+    //
+    // An empty CPU list, or -1, leaves the corresponding threads unpinned.
+    struct ThreadTopology {
+        //事件循环(listener_thread_)所在的CPU
+        int loop_cpu = -1;
+        //第i个worker绑定到worker_cpus[i % size]
+        std::vector<int> worker_cpus;
+        //kDedicatedPool路由使用的线程池
+        std::vector<int> dedicated_worker_cpus;
+        //网卡RX队列的中断号，中断绑定到loop_cpu上；需要root权限，失败时忽略
+        std::vector<int> rx_queue_irqs;
+
+        //把所有线程放在一个NUMA节点上：第一个CPU给事件循环，其余CPU给worker
+        //节点不存在时返回不绑定任何线程的配置
+        static ThreadTopology ForNumaNode(int node);
+    };
+
+    //节点上的在线CPU，读取/sys/devices/system/node/node<N>/cpulist
+    std::vector<int> NumaNodeCpus(int node);
+
+    bool PinThread(pthread_t thread, int cpu);
+
+    bool PinCurrentThread(int cpu);
+
+    //写/proc/irq/<irq>/smp_affinity_list
+    bool SetIrqAffinity(int irq, int cpu);
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_THREADTOPOLOGY_H
@@ -0,0 +1,182 @@
+#include "TlsContext.h"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+
+namespace snow {
+    namespace {
+        // Plaintext read from a file per SSL_write when the kernel does not encrypt;
+        // one full TLS record.
+        constexpr size_t kFileChunk = 16 * 1024;
+    } // namespace
+
+    std::shared_ptr<TlsContext> TlsContext::Create(const TlsConfig &config) {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx) {
+            return nullptr;
+        }
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        // Clients that close without close_notify are normal for HTTP; treat that as EOF.
+        std::uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF |
+                                SSL_OP_CIPHER_SERVER_PREFERENCE;
+        if (config.kernel_tls) {
+            // OpenSSL sets TCP_ULP "tls" and hands the traffic keys to the kernel once
+            // the handshake is done, when both the kernel and the cipher support it.
+            options |= SSL_OP_ENABLE_KTLS;
+        }
+        SSL_CTX_set_options(ctx, options);
+        // Non-blocking writes may complete partially and are retried from wherever the
+        // caller's buffer lives by then.
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+
+        // Resumption skips the certificate and key exchange work of a full handshake:
+        // stateless tickets for TLS 1.3 and ticket-capable 1.2 clients, plus a session
+        // cache for 1.2 clients that only send a session id.
+        static constexpr unsigned char kSessionContext[] = "snow";
+        SSL_CTX_set_session_id_context(ctx, kSessionContext, sizeof(kSessionContext) - 1);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, static_cast<long>(config.session_cache_size));
+        SSL_CTX_set_timeout(ctx, static_cast<long>(config.session_timeout.count()));
+        SSL_CTX_set_num_tickets(ctx, 1);
+
+        if (SSL_CTX_use_certificate_chain_file(ctx, config.certificate_chain.c_str()) != 1) {
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        if (SSL_CTX_use_PrivateKey_file(ctx, config.private_key.c_str(), SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_check_private_key(ctx) != 1) {
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        return std::shared_ptr<TlsContext>(new TlsContext(ctx));
+    }
+
+    TlsContext::TlsContext(SSL_CTX *ctx) : ctx_(ctx) {}
+
+    TlsContext::~TlsContext() {
+        SSL_CTX_free(ctx_);
+    }
+
+    std::unique_ptr<TlsConnection> TlsContext::Accept(int fd) const {
+        SSL *ssl = SSL_new(ctx_);
+        if (!ssl) {
+            ERR_clear_error();
+            return nullptr;
+        }
+        if (SSL_set_fd(ssl, fd) != 1) {
+            ERR_clear_error();
+            SSL_free(ssl);
+            return nullptr;
+        }
+        SSL_set_accept_state(ssl);
+        return std::make_unique<TlsConnection>(ssl);
+    }
+
+    TlsConnection::TlsConnection(SSL *ssl) : ssl_(ssl) {}
+
+    TlsConnection::~TlsConnection() {
+        SSL_free(ssl_);
+    }
+
+    TlsConnection::HandshakeStatus TlsConnection::Handshake() {
+        ERR_clear_error();
+        int result = SSL_do_handshake(ssl_);
+        if (result == 1) {
+            established_ = true;
+#ifndef OPENSSL_NO_KTLS
+            kernel_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+            kernel_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+#endif
+            return HandshakeStatus::kDone;
+        }
+        switch (SSL_get_error(ssl_, result)) {
+            case SSL_ERROR_WANT_READ:
+                return HandshakeStatus::kWantRead;
+            case SSL_ERROR_WANT_WRITE:
+                return HandshakeStatus::kWantWrite;
+            default:
+                ERR_clear_error();
+                return HandshakeStatus::kFailed;
+        }
+    }
+
+    ssize_t TlsConnection::Read(void *buffer, size_t length) {
+        ERR_clear_error();
+        int result = SSL_read(ssl_, buffer, static_cast<int>(std::min<size_t>(length, INT_MAX)));
+        return result > 0 ? result : Fail(result);
+    }
+
+    bool TlsConnection::has_pending() const {
+        return SSL_pending(ssl_) > 0;
+    }
+
+    ssize_t TlsConnection::Write(const void *data, size_t length) {
+        ERR_clear_error();
+        int result = SSL_write(ssl_, data, static_cast<int>(std::min<size_t>(length, INT_MAX)));
+        return result > 0 ? result : Fail(result);
+    }
+
+    ssize_t TlsConnection::SendFile(int file_fd, off_t *offset, size_t length) {
+        if (kernel_send_) {
+            // The kernel encrypts straight from the page cache
+            ERR_clear_error();
+            ossl_ssize_t sent = SSL_sendfile(ssl_, file_fd, *offset, length, 0);
+            if (sent < 0) {
+                return Fail(static_cast<int>(sent));
+            }
+            *offset += sent;
+            return sent;
+        }
+        // A retry after EAGAIN reads the same bytes again, since *offset has not moved.
+        char buffer[kFileChunk];
+        ssize_t n = pread(file_fd, buffer, std::min(length, sizeof(buffer)), *offset);
+        if (n <= 0) {
+            return n;
+        }
+        ssize_t sent = Write(buffer, static_cast<size_t>(n));
+        if (sent > 0) {
+            *offset += sent;
+        }
+        return sent;
+    }
+
+    void TlsConnection::Shutdown() {
+        if (established_) {
+            ERR_clear_error();
+            SSL_shutdown(ssl_);
+            ERR_clear_error();
+        }
+    }
+
+    bool TlsConnection::resumed() const {
+        return SSL_session_reused(ssl_) == 1;
+    }
+
+    ssize_t TlsConnection::Fail(int result) {
+        int saved_errno = errno;
+        int error = SSL_get_error(ssl_, result);
+        ERR_clear_error();
+        switch (error) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+            case SSL_ERROR_ZERO_RETURN:
+                return 0;
+            case SSL_ERROR_SYSCALL:
+                errno = saved_errno != 0 ? saved_errno : EIO;
+                return -1;
+            default:
+                errno = EIO;
+                return -1;
+        }
+    }
+
+} // snow
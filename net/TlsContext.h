@@ -0,0 +1,113 @@
+#ifndef SNOW_HTTP_SERVER_TLSCONTEXT_H
+#define SNOW_HTTP_SERVER_TLSCONTEXT_H
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+//不在头文件中引入OpenSSL，和<openssl/ssl.h>中的typedef一致
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+namespace snow {
+
+    //TLS监听地址的配置
+    struct TlsConfig {
+        std::string certificate_chain;      //PEM格式，服务器证书在前，然后是中间证书
+        std::string private_key;            //PEM格式
+        //握手之后由内核加密记录(kTLS)，sendfile仍然可用；不支持时连接留在用户态加密
+        bool kernel_tls = true;
+        //服务端session缓存(TLS 1.2的session id)的条目数和有效期，session ticket总是开启
+        size_t session_cache_size = 20 * 1024;
+        std::chrono::seconds session_timeout{300};
+    };
+
+    class TlsConnection;
+
+    // Certificates, keys and the session cache shared by every connection of one or
+    // more TLS listeners. Safe to use from several threads.
+    class TlsContext {
+    public:
+        //加载证书和私钥，失败时返回nullptr，原因留在OpenSSL的错误队列里(ERR_get_error)
+        static std::shared_ptr<TlsContext> Create(const TlsConfig &config);
+
+        ~TlsContext();
+
+        TlsContext(const TlsContext &) = delete;
+
+        TlsContext &operator=(const TlsContext &) = delete;
+
+        //为accept得到的非阻塞socket创建服务端连接，握手由TlsConnection::Handshake完成
+        std::unique_ptr<TlsConnection> Accept(int fd) const;
+
+    private:
+        explicit TlsContext(SSL_CTX *ctx);
+
+        SSL_CTX *ctx_;
+    };
+
+    // One server side TLS session on a non-blocking socket.
+    //
+    // Read, Write and SendFile follow the conventions of read(2), send(2) and
+    // sendfile(2): they return -1 with errno EAGAIN when the socket is not ready, so
+    // callers keep their existing retry logic. A call that returned EAGAIN must be
+    // repeated with the same data, as OpenSSL requires. Once the kernel encrypts
+    // records, writes go straight to the socket and SendFile is a real sendfile.
+    class TlsConnection {
+    public:
+        enum class HandshakeStatus {
+            kDone,
+            kWantRead,      //等EPOLLIN之后再调用
+            kWantWrite,     //等EPOLLOUT之后再调用
+            kFailed
+        };
+
+        explicit TlsConnection(SSL *ssl);
+
+        ~TlsConnection();
+
+        TlsConnection(const TlsConnection &) = delete;
+
+        TlsConnection &operator=(const TlsConnection &) = delete;
+
+        HandshakeStatus Handshake();
+
+        ssize_t Read(void *buffer, size_t length);
+
+        ssize_t Write(const void *data, size_t length);
+
+        //发送文件的[*offset, *offset + length)，成功时向后移动*offset
+        ssize_t SendFile(int file_fd, off_t *offset, size_t length);
+
+        //发出close_notify，不等待对端的回应
+        void Shutdown();
+
+        bool established() const { return established_; }
+
+        //OpenSSL里已经解密、还没被Read取走的数据，epoll看不到它们
+        bool has_pending() const;
+
+        //握手之后由内核加密发送/解密接收
+        bool kernel_send() const { return kernel_send_; }
+
+        bool kernel_recv() const { return kernel_recv_; }
+
+        //这次握手复用了之前的session
+        bool resumed() const;
+
+    private:
+        SSL *ssl_;
+        bool established_ = false;
+        bool kernel_send_ = false;
+        bool kernel_recv_ = false;
+
+        //把SSL_get_error的结果转换成read/send风格的返回值和errno
+        ssize_t Fail(int result);
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_TLSCONTEXT_H
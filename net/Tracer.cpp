@@ -0,0 +1,152 @@
+#include "Tracer.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace snow {
+    namespace {
+        constexpr size_t kRingSize = 8192;     //每个线程保留的span数，必须是2的幂
+
+        // One span slot, guarded by a sequence counter: odd while the owning thread is
+        // writing it. A reader that sees the same even value before and after copying
+        // the fields got a consistent span. The fields are relaxed atomics only so
+        // that this racy read is well defined; on x86 they are plain moves.
+        struct Slot {
+            std::atomic<std::uint32_t> sequence{0};
+            std::atomic<const char *> name{nullptr};
+            std::atomic<std::uint64_t> trace_id{0};
+            std::atomic<std::uint64_t> start{0};
+            std::atomic<std::uint64_t> end{0};
+        };
+
+        struct Ring {
+            long tid = 0;
+            std::atomic<std::uint64_t> head{0};     //下一个要写的位置，只增不减
+            Slot slots[kRingSize];
+        };
+
+        struct SpanCopy {
+            const char *name;
+            std::uint64_t trace_id;
+            std::uint64_t start;
+            std::uint64_t end;
+        };
+
+        // Every ring ever created. Rings are never freed so a dump can still read the
+        // history of threads that have exited; there is one per thread that traced.
+        std::mutex registry_mutex;
+        std::vector<std::unique_ptr<Ring>> &Registry() {
+            static std::vector<std::unique_ptr<Ring>> rings;
+            return rings;
+        }
+
+        Ring &ThisThreadRing() {
+            thread_local Ring *ring = [] {
+                auto owned = std::make_unique<Ring>();
+                owned->tid = static_cast<long>(syscall(SYS_gettid));
+                Ring *raw = owned.get();
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                Registry().push_back(std::move(owned));
+                return raw;
+            }();
+            return *ring;
+        }
+
+        void AppendEscaped(std::string *out, const char *text) {
+            for (const char *p = text; *p; ++p) {
+                if (*p == '"' || *p == '\\') out->push_back('\\');
+                out->push_back(*p);
+            }
+        }
+    } // namespace
+
+    std::atomic<std::uint32_t> Tracer::sample_one_in_{0};
+    std::atomic<std::uint64_t> Tracer::next_request_{0};
+
+    void Tracer::SetSampling(std::uint32_t one_in) {
+        sample_one_in_.store(one_in, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Tracer::StartRequest() {
+        std::uint32_t one_in = sample_one_in_.load(std::memory_order_relaxed);
+        if (one_in == 0) {
+            return 0;
+        }
+        std::uint64_t request = next_request_.fetch_add(1, std::memory_order_relaxed) + 1;
+        return request % one_in == 0 ? request : 0;
+    }
+
+    std::uint64_t Tracer::Now() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void Tracer::Record(const char *name, std::uint64_t trace_id, std::uint64_t start_ns, std::uint64_t end_ns) {
+        Ring &ring = ThisThreadRing();
+        std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+        Slot &slot = ring.slots[head & (kRingSize - 1)];
+
+        std::uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.trace_id.store(trace_id, std::memory_order_relaxed);
+        slot.start.store(start_ns, std::memory_order_relaxed);
+        slot.end.store(end_ns, std::memory_order_relaxed);
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    std::string Tracer::ExportChromeTrace() {
+        std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        char number[160];
+
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto &ring : Registry()) {
+            std::uint64_t head = ring->head.load(std::memory_order_acquire);
+            std::uint64_t begin = head > kRingSize ? head - kRingSize : 0;
+            for (std::uint64_t i = begin; i < head; ++i) {
+                const Slot &slot = ring->slots[i & (kRingSize - 1)];
+                std::uint32_t before = slot.sequence.load(std::memory_order_acquire);
+                if (before & 1) continue;
+                SpanCopy span{slot.name.load(std::memory_order_relaxed),
+                              slot.trace_id.load(std::memory_order_relaxed),
+                              slot.start.load(std::memory_order_relaxed),
+                              slot.end.load(std::memory_order_relaxed)};
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) != before || !span.name) {
+                    continue;   //读的时候被覆盖了
+                }
+
+                if (!first) json += ',';
+                first = false;
+                json += "{\"name\":\"";
+                AppendEscaped(&json, span.name);
+                // Chrome trace timestamps are microseconds; keep the nanoseconds as decimals.
+                snprintf(number, sizeof(number),
+                         "\",\"ph\":\"X\",\"pid\":1,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+                         ring->tid, static_cast<double>(span.start) / 1000.0,
+                         static_cast<double>(span.end - span.start) / 1000.0,
+                         static_cast<unsigned long long>(span.trace_id));
+                json += number;
+            }
+        }
+        json += "]}";
+        return json;
+    }
+
+    bool Tracer::DumpChromeTrace(const std::string &path) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << ExportChromeTrace();
+        return static_cast<bool>(file);
+    }
+
+} // snow
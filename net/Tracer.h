@@ -0,0 +1,70 @@
+#ifndef SNOW_HTTP_SERVER_TRACER_H
+#define SNOW_HTTP_SERVER_TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace snow {
+
+    // Low-overhead request tracing.
+    //
+    // A sampled request gets a non-zero trace id when its connection is accepted, and
+    // every stage it passes through (accept, read, admission, pool queue, parse,
+    // handler, write) records a span tagged with that id. Spans go into a ring
+    // buffer owned by the recording thread: one writer, no locks, no allocation after
+    // the thread's first span. Old spans are overwritten, so the buffers always hold
+    // the most recent history.
+    //
+    // Requests that are not sampled carry trace id 0 and cost a branch per stage.
+    //
+    // ExportChromeTrace() renders every thread's buffer as Chrome trace JSON
+    // (chrome://tracing, ui.perfetto.dev); filtering on args.request gives one
+    // request's timeline across threads.
+    class Tracer {
+    public:
+        //每one_in个请求采样一个，1表示全部采样，0表示关闭(默认)
+        static void SetSampling(std::uint32_t one_in);
+
+        //为一个新请求决定是否采样，返回trace id，不采样时返回0
+        static std::uint64_t StartRequest();
+
+        //单调时钟，纳秒
+        static std::uint64_t Now();
+
+        //name必须是字符串字面量(只保存指针)
+        static void Record(const char *name, std::uint64_t trace_id, std::uint64_t start_ns, std::uint64_t end_ns);
+
+        //所有线程缓冲区中的span，Chrome trace event格式
+        static std::string ExportChromeTrace();
+
+        static bool DumpChromeTrace(const std::string &path);
+
+    private:
+        static std::atomic<std::uint32_t> sample_one_in_;
+        static std::atomic<std::uint64_t> next_request_;
+    };
+
+    // Records the enclosing scope as a span of a sampled request.
+    class TraceSpan {
+    public:
+        TraceSpan(const char *name, std::uint64_t trace_id)
+                : name_(name), trace_id_(trace_id), start_(trace_id ? Tracer::Now() : 0) {}
+
+        ~TraceSpan() {
+            if (trace_id_) Tracer::Record(name_, trace_id_, start_, Tracer::Now());
+        }
+
+        TraceSpan(const TraceSpan &) = delete;
+
+        TraceSpan &operator=(const TraceSpan &) = delete;
+
+    private:
+        const char *name_;
+        std::uint64_t trace_id_;
+        std::uint64_t start_;
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_TRACER_H
@@ -0,0 +1,293 @@
+#include "UploadSink.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+namespace snow {
+
+    UploadSink::UploadSink(HttpRequest request, int sink_fd, bool chunked, size_t content_length)
+            : request_(std::move(request)),
+              sink_fd_(sink_fd),
+              chunked_(chunked),
+              stage_(chunked ? Stage::kChunkSize : Stage::kData),
+              remaining_(chunked ? 0 : content_length) {
+        if (!chunked_ && remaining_ == 0) {
+            stage_ = Stage::kDone;
+        }
+    }
+
+    UploadSink::~UploadSink() {
+        if (pipe_[0] != -1) close(pipe_[0]);
+        if (pipe_[1] != -1) close(pipe_[1]);
+    }
+
+    bool UploadSink::Open() {
+        if (pipe2(pipe_, O_CLOEXEC | O_NONBLOCK) == -1) {
+            pipe_[0] = pipe_[1] = -1;
+            return false;
+        }
+        //默认64 KiB的管道容量会让大文件需要很多次splice，尽量调大，失败也不影响正确性
+        fcntl(pipe_[1], F_SETPIPE_SZ, static_cast<int>(kPipeSize));
+        int flags = fcntl(sink_fd_, F_GETFL);
+        if (flags == -1 || fcntl(sink_fd_, F_SETFL, flags | O_NONBLOCK) == -1) {
+            return false;
+        }
+        sink_flags_ = flags;
+        return true;
+    }
+
+    void UploadSink::RestoreSink() {
+        if (sink_flags_ != -1) {
+            fcntl(sink_fd_, F_SETFL, sink_flags_);
+            sink_flags_ = -1;
+        }
+    }
+
+    UploadSink::Status UploadSink::Consume(std::string_view data) {
+        while (!data.empty() && stage_ != Stage::kDone) {
+            if (stage_ == Stage::kData) {
+                size_t length = std::min(remaining_, data.size());
+                ssize_t written = WriteSink(data.data(), length);
+                if (written < 0) {
+                    return Status::kSinkFailed;
+                }
+                bytes_ += static_cast<size_t>(written);
+                remaining_ -= static_cast<size_t>(written);
+                data.remove_prefix(static_cast<size_t>(written));
+                if (remaining_ == 0) {
+                    DataFinished();
+                } else if (static_cast<size_t>(written) < length) {
+                    //Flush从这里继续
+                    backlog_.assign(data);
+                    return Status::kSinkBlocked;
+                }
+            } else {
+                size_t newline = data.find('\n');
+                size_t length = newline == std::string_view::npos ? data.size() : newline + 1;
+                if (auto status = AppendLine(data.substr(0, length))) {
+                    return *status;
+                }
+                data.remove_prefix(length);
+            }
+        }
+        //Content-Length之后多出来的字节属于下一个请求，连接在响应后会关闭，直接忽略
+        return stage_ == Stage::kDone ? Status::kDone : Status::kNeedMore;
+    }
+
+    UploadSink::Status UploadSink::Flush() {
+        if (std::optional<Status> status = DrainPipe()) {
+            return *status;
+        }
+        if (!backlog_.empty()) {
+            std::string data;
+            data.swap(backlog_);
+            return Consume(data);
+        }
+        return stage_ == Stage::kDone ? Status::kDone : Status::kNeedMore;
+    }
+
+    UploadSink::Status UploadSink::Pump(int socket_fd) {
+        Status flushed = Flush();
+        if (flushed != Status::kNeedMore) {
+            return flushed;
+        }
+        // What is left in the socket after the budget is reported again once the
+        // caller re-arms EPOLLIN, so other connections get their turn in between.
+        size_t budget = kMaxBytesPerPump;
+        while (stage_ != Stage::kDone) {
+            if (budget == 0) {
+                return Status::kNeedMore;
+            }
+            std::optional<Status> status = stage_ == Stage::kData ? SpliceData(socket_fd, &budget)
+                                                                  : ReadLine(socket_fd, &budget);
+            if (status) {
+                return *status;
+            }
+        }
+        return Status::kDone;
+    }
+
+    std::optional<UploadSink::Status> UploadSink::AppendLine(std::string_view piece) {
+        line_.append(piece);
+        if (line_.size() > kMaxLineLength) {
+            return Status::kBadBody;
+        }
+        if (line_.back() != '\n') {
+            return std::nullopt;
+        }
+        std::string_view line(line_);
+        line.remove_suffix(1);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        std::optional<Status> status = OnLine(line);
+        line_.clear();
+        return status;
+    }
+
+    // Chunked framing, RFC 7230 4.1.
+    std::optional<UploadSink::Status> UploadSink::OnLine(std::string_view line) {
+        switch (stage_) {
+            case Stage::kChunkSize: {
+                //忽略chunk-ext
+                line = line.substr(0, line.find(';'));
+                while (!line.empty() && (line.back() == ' ' || line.back() == '\t')) line.remove_suffix(1);
+                if (line.empty() || line.size() > 2 * sizeof(size_t)) {
+                    return Status::kBadBody;
+                }
+                size_t size = 0;
+                for (char c : line) {
+                    int digit;
+                    if (c >= '0' && c <= '9') digit = c - '0';
+                    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+                    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+                    else return Status::kBadBody;
+                    size = size * 16 + static_cast<size_t>(digit);
+                }
+                if (size == 0) {
+                    stage_ = Stage::kTrailer;
+                } else {
+                    stage_ = Stage::kData;
+                    remaining_ = size;
+                }
+                return std::nullopt;
+            }
+            case Stage::kChunkDataEnd:
+                if (!line.empty()) {
+                    return Status::kBadBody;
+                }
+                stage_ = Stage::kChunkSize;
+                return std::nullopt;
+            case Stage::kTrailer:
+                //trailer字段直接丢弃，空行表示body结束
+                if (line.empty()) {
+                    stage_ = Stage::kDone;
+                }
+                return std::nullopt;
+            default:
+                return Status::kBadBody;
+        }
+    }
+
+    // Framing lines are short, so they are peeked and then consumed up to the newline;
+    // nothing past the line is taken from the socket.
+    std::optional<UploadSink::Status> UploadSink::ReadLine(int socket_fd, size_t *budget) {
+        char buffer[128];
+        ssize_t peeked = recv(socket_fd, buffer, std::min(sizeof(buffer), *budget), MSG_PEEK);
+        if (peeked == 0) {
+            return Status::kDisconnected;
+        }
+        if (peeked < 0) {
+            if (errno == EINTR) return std::nullopt;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return Status::kNeedMore;
+            return Status::kDisconnected;
+        }
+        std::string_view peek(buffer, static_cast<size_t>(peeked));
+        size_t newline = peek.find('\n');
+        size_t length = newline == std::string_view::npos ? peek.size() : newline + 1;
+        //数据已经在socket缓冲区里，这次recv不会阻塞
+        if (recv(socket_fd, buffer, length, 0) != static_cast<ssize_t>(length)) {
+            return Status::kDisconnected;
+        }
+        *budget -= length;
+        return AppendLine(std::string_view(buffer, length));
+    }
+
+    std::optional<UploadSink::Status> UploadSink::SpliceData(int socket_fd, size_t *budget) {
+        while (remaining_ > 0) {
+            if (*budget == 0) {
+                return Status::kNeedMore;
+            }
+            ssize_t moved = splice(socket_fd, nullptr, pipe_[1], nullptr, std::min({remaining_, kPipeSize, *budget}),
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved == 0) {
+                return Status::kDisconnected;
+            }
+            if (moved < 0) {
+                if (errno == EINTR) continue;
+                //只有管道被清空之后才会走到这里，所以EAGAIN只可能是socket读空了
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return Status::kNeedMore;
+                return Status::kDisconnected;
+            }
+            remaining_ -= static_cast<size_t>(moved);
+            piped_ += static_cast<size_t>(moved);
+            *budget -= static_cast<size_t>(moved);
+            if (std::optional<Status> status = DrainPipe()) {
+                return status;
+            }
+        }
+        DataFinished();
+        return std::nullopt;
+    }
+
+    std::optional<UploadSink::Status> UploadSink::DrainPipe() {
+        if (!spill_.empty()) {
+            ssize_t written = WriteSink(spill_.data(), spill_.size());
+            if (written < 0) {
+                return Status::kSinkFailed;
+            }
+            bytes_ += static_cast<size_t>(written);
+            spill_.erase(0, static_cast<size_t>(written));
+            if (!spill_.empty()) {
+                return Status::kSinkBlocked;
+            }
+        }
+        while (piped_ > 0 && !copy_fallback_) {
+            ssize_t moved = splice(pipe_[0], nullptr, sink_fd_, nullptr, piped_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                piped_ -= static_cast<size_t>(moved);
+                bytes_ += static_cast<size_t>(moved);
+            } else if (moved < 0 && errno == EINTR) {
+                continue;
+            } else if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                //管道里有数据，所以是sink写满了
+                return Status::kSinkBlocked;
+            } else if (moved < 0 && errno == EINVAL) {
+                copy_fallback_ = true;
+            } else {
+                return Status::kSinkFailed;
+            }
+        }
+        //退回到经过用户空间的拷贝，sink没接受的部分留在spill_里
+        char buffer[16 * 1024];
+        while (piped_ > 0) {
+            ssize_t n = read(pipe_[0], buffer, std::min(piped_, sizeof(buffer)));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                return Status::kSinkFailed;
+            }
+            piped_ -= static_cast<size_t>(n);
+            ssize_t written = WriteSink(buffer, static_cast<size_t>(n));
+            if (written < 0) {
+                return Status::kSinkFailed;
+            }
+            bytes_ += static_cast<size_t>(written);
+            if (written < n) {
+                spill_.assign(buffer + written, static_cast<size_t>(n - written));
+                return Status::kSinkBlocked;
+            }
+        }
+        return std::nullopt;
+    }
+
+    ssize_t UploadSink::WriteSink(const char *data, size_t length) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t written = write(sink_fd_, data + done, length - done);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return -1;
+            }
+            done += static_cast<size_t>(written);
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    void UploadSink::DataFinished() {
+        stage_ = chunked_ ? Stage::kChunkDataEnd : Stage::kDone;
+    }
+
+} // snow
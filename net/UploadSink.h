@@ -0,0 +1,126 @@
+#ifndef SNOW_HTTP_SERVER_UPLOADSINK_H
+#define SNOW_HTTP_SERVER_UPLOADSINK_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "http/http_message.h"
+
+namespace snow {
+
+    // Moves a request body from a socket into a file or pipe without copying the
+    // payload through user space.
+    //
+    // Body bytes go socket -> internal pipe -> sink with splice(2); only framing
+    // (chunk-size lines and the CRLFs around chunk data) is read into memory. Bytes
+    // that arrived in the same read as the headers are already in user space and are
+    // written to the sink directly.
+    //
+    // The sink is switched to non-blocking mode for the upload, so a pipe whose
+    // reader falls behind reports kSinkBlocked instead of stalling the event loop;
+    // what it refused is kept and written first by the next Pump or Flush. A single
+    // Pump moves at most kMaxBytesPerPump bytes, so one fast client cannot hold the
+    // loop either.
+    class UploadSink {
+    public:
+        enum class Status {
+            kNeedMore,      //socket已经读空或者这一轮的字节数用完，等下一次EPOLLIN
+            kSinkBlocked,   //sink暂时写不进去(管道满)，等sink可写之后再Pump
+            kDone,          //body已经完整写入sink
+            kBadBody,       //chunked格式错误
+            kSinkFailed,    //写sink失败(磁盘满、管道读端关闭等)
+            kDisconnected   //body收完之前对端关闭
+        };
+
+        //一次Pump最多从socket搬运的字节数
+        static constexpr size_t kMaxBytesPerPump = 1 << 20;
+
+        //content_length只在chunked为false时使用
+        UploadSink(HttpRequest request, int sink_fd, bool chunked, size_t content_length);
+
+        //关闭内部的管道，sink_fd的所有权属于handler，这里不关闭
+        ~UploadSink();
+
+        UploadSink(const UploadSink &) = delete;
+
+        UploadSink &operator=(const UploadSink &) = delete;
+
+        //创建内部管道并把sink设为非阻塞，失败时返回false
+        bool Open();
+
+        //恢复sink在Open之前的文件状态标志，把sink交还给handler之前调用
+        void RestoreSink();
+
+        //和header一起读到的那部分body，或者TLS解密出来的数据；需要先Flush成功
+        Status Consume(std::string_view data);
+
+        //写出上次sink写不进去的数据，全部写出后返回kNeedMore(body已经结束时返回kDone)
+        Status Flush();
+
+        //先Flush，然后从socket搬运body直到读空(EAGAIN)、达到kMaxBytesPerPump、body结束或出错
+        Status Pump(int socket_fd);
+
+        const HttpRequest &request() const { return request_; }
+
+        int sink() const { return sink_fd_; }
+
+        //已经写入sink的body字节数(不含chunked的分块信息)
+        size_t bytes() const { return bytes_; }
+
+    private:
+        //每次splice()经过pipe的字节数，系统允许时把pipe扩大到这个大小
+        static constexpr size_t kPipeSize = 1 << 20;
+        //一行chunk-size或trailer的最大长度
+        static constexpr size_t kMaxLineLength = 1024;
+
+        enum class Stage {
+            kData,          //remaining_字节的body数据(Content-Length，或者当前chunk)
+            kChunkSize,
+            kChunkDataEnd,  //chunk数据之后的CRLF
+            kTrailer,
+            kDone
+        };
+
+        HttpRequest request_;
+        int sink_fd_;
+        int sink_flags_ = -1;   //Open之前sink的文件状态标志
+        int pipe_[2] = {-1, -1};
+        size_t piped_ = 0;      //已经在内部管道里、还没写进sink的字节数
+        std::string spill_;     //退回到read + write时从管道读出、sink没有接受的数据
+        std::string backlog_;   //Consume时sink写不进去，还没处理的那部分输入
+        bool chunked_;
+        Stage stage_;
+        size_t remaining_;
+        size_t bytes_ = 0;
+        std::string line_;      //还不完整的分块信息行
+
+        //sink不支持splice时(例如某些内核上以O_APPEND打开的文件)退回到read + write
+        bool copy_fallback_ = false;
+
+        //piece是一行分块信息的一部分，以'\n'结尾时处理整行
+        //返回nullopt表示可以继续
+        std::optional<Status> AppendLine(std::string_view piece);
+
+        std::optional<Status> OnLine(std::string_view line);
+
+        //budget是这一轮还能从socket读的字节数
+        std::optional<Status> ReadLine(int socket_fd, size_t *budget);
+
+        std::optional<Status> SpliceData(int socket_fd, size_t *budget);
+
+        //把spill_和管道中的数据写进sink，写完返回nullopt，否则返回kSinkBlocked或kSinkFailed
+        std::optional<Status> DrainPipe();
+
+        //返回sink在写满之前接受的字节数，出错时返回-1
+        ssize_t WriteSink(const char *data, size_t length);
+
+        void DataFinished();
+    };
+
+} // snow
+
+#endif //SNOW_HTTP_SERVER_UPLOADSINK_H